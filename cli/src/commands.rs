@@ -2,9 +2,12 @@ pub mod getuser;
 pub mod getuserbook;
 pub mod insertjournal;
 pub mod listbookmarks;
+pub mod listcontent;
 pub mod listeditions;
 pub mod listjournal;
 pub mod search;
+pub mod serve;
 pub mod setuserbook;
 pub mod update;
+pub mod updatebatch;
 pub mod updatejournal;
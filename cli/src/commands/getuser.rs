@@ -9,7 +9,7 @@ use macros::AggregateErrors;
 
 use crate::config::JournalPrivacy;
 use crate::log;
-use crate::utils::{GraphQLQueryExt, VERSION};
+use crate::utils::{GraphQLQueryExt, VERSION, send_result};
 
 #[derive(GraphQLQuery)]
 #[graphql(
@@ -49,16 +49,13 @@ pub fn run(args: &GetUser) -> Result<()> {
 
   let user = get_user()?;
 
-  log!(
-    "BEGIN_JSON\n{}",
-    json!({
-      "id": user.id,
-      "username": user.username,
-      "account_privacy_setting_id": user.account_privacy_setting_id,
-      "account_privacy_setting": JournalPrivacy::try_from(user.account_privacy_setting_id)
-        .context("Failed to parse <i>account_privacy_setting_id</i>")?,
-    })
-  )?;
+  send_result(&json!({
+    "id": user.id,
+    "username": user.username,
+    "account_privacy_setting_id": user.account_privacy_setting_id,
+    "account_privacy_setting": JournalPrivacy::try_from(user.account_privacy_setting_id)
+      .context("Failed to parse <i>account_privacy_setting_id</i>")?,
+  }))?;
 
   Ok(())
 }
@@ -7,7 +7,7 @@ use macros::AggregateErrors;
 
 use crate::commands::getuser::get_user;
 use crate::log;
-use crate::utils::{GraphQLQueryExt, VERSION, book_not_found, normalize_identifiers};
+use crate::utils::{GraphQLQueryExt, VERSION, book_not_found, normalize_identifiers, send_result};
 
 #[derive(GraphQLQuery)]
 #[graphql(
@@ -63,7 +63,7 @@ pub fn run(args: &GetUserBook) -> Result<()> {
     })
   });
 
-  log!("BEGIN_JSON\n{user_book}")?;
+  send_result(&user_book)?;
 
   Ok(())
 }
@@ -73,15 +73,22 @@ pub fn get_book(isbn: Vec<String>, linked_id: i64) -> Result<(get_edition::GetEd
   let isbn_display = isbn.join(", ");
 
   // retrieve book, edition and maybe user book and user book read
-  let book = match GetEdition::send_request(get_edition::Variables {
+  let data = GetEdition::send_request(get_edition::Variables {
     isbn,
     linked_id,
     user_id,
-  })?
-  .editions
-  .into_iter()
-  .next()
-  {
+  })?;
+
+  pick_edition(data, &isbn_display, linked_id)
+}
+
+/// Find the book, the edition being read and its page count in a `GetEdition` response.
+pub fn pick_edition(
+  data: get_edition::ResponseData,
+  isbn_display: &str,
+  linked_id: i64,
+) -> Result<(get_edition::GetEditionEditionsBook, i64, i64)> {
+  let book = match data.editions.into_iter().next() {
     Some(edition) => edition.book,
     None => book_not_found(&if linked_id != 0 {
       format!(
@@ -5,7 +5,7 @@ use serde_json::json;
 
 use crate::config::CONFIG;
 use crate::log;
-use crate::utils::VERSION;
+use crate::utils::{VERSION, send_result};
 
 /// List aggregated bookmarks.
 #[derive(FromArgs, PartialEq, Debug)]
@@ -53,7 +53,7 @@ pub fn run(args: &ListBookmarks) -> Result<()> {
     return Ok(());
   }
 
-  log!("BEGIN_JSON\n{}", json!({ "bookmarks": bookmarks}))?;
+  send_result(&json!({ "bookmarks": bookmarks }))?;
 
   Ok(())
 }
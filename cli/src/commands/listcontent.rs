@@ -0,0 +1,31 @@
+use anyhow::{Context, Result};
+use argh::FromArgs;
+use rusqlite::{Connection, OpenFlags};
+use serde_json::json;
+
+use crate::config::CONFIG;
+use crate::log;
+use crate::utils::{VERSION, send_result};
+
+/// List the content ids of every book on the device.
+#[derive(FromArgs, PartialEq, Debug)]
+#[argh(subcommand, name = "list-content")]
+pub struct ListContent {}
+
+pub fn run(args: &ListContent) -> Result<()> {
+  log!("{} {:?}", &*VERSION, args)?;
+
+  let content_ids = Connection::open_with_flags(&CONFIG.sqlite_path, OpenFlags::SQLITE_OPEN_READ_ONLY)
+    .context(format!(
+      "Failed to connect to the database <i>{}</i>",
+      &CONFIG.sqlite_path
+    ))?
+    .prepare("SELECT ContentId FROM content WHERE BookTitle is null;")
+    .context("Failed to prepare list content query")?
+    .query_map([], |row| row.get::<_, String>(0))
+    .context("Failed to run list content query")?
+    .collect::<Result<Vec<_>, _>>()
+    .context("Failed to map list content query result")?;
+
+  send_result(&json!({ "content_ids": content_ids }))
+}
@@ -7,7 +7,7 @@ use macros::AggregateErrors;
 
 use crate::commands::getuser::get_user;
 use crate::log;
-use crate::utils::{GraphQLQueryExt, VERSION, normalize_identifiers};
+use crate::utils::{GraphQLQueryExt, VERSION, normalize_identifiers, send_result};
 
 #[derive(GraphQLQuery)]
 #[graphql(
@@ -70,7 +70,7 @@ pub fn run(args: &ListJournal) -> Result<()> {
   .collect::<Vec<_>>();
 
   log!("Found {}", journals.len())?;
-  log!("BEGIN_JSON\n{}", json!({ "reading_journals": journals}))?;
+  send_result(&json!({ "reading_journals": journals }))?;
 
   Ok(())
 }
@@ -6,7 +6,7 @@ use serde_json::{Value, json};
 use macros::AggregateErrors;
 
 use crate::log;
-use crate::utils::{GraphQLQueryExt, VERSION};
+use crate::utils::{GraphQLQueryExt, VERSION, send_result};
 
 #[derive(GraphQLQuery)]
 #[graphql(
@@ -80,17 +80,13 @@ pub fn run(args: Search) -> Result<()> {
     })
     .collect::<Vec<_>>();
 
-  log!(
-    "BEGIN_JSON\n{}",
-    json!({
-      "results": hits,
-      "page": results.get("page"),
-      "total": match results.get("found").and_then(Value::as_f64) {
-        Some(0.0) => 0,
-        Some(n) => ((n / args.limit as f64).ceil() as i64).max(1),
-        None => 1,
-      }
-    })
-    .to_string()
-  )
+  send_result(&json!({
+    "results": hits,
+    "page": results.get("page"),
+    "total": match results.get("found").and_then(Value::as_f64) {
+      Some(0.0) => 0,
+      Some(n) => ((n / args.limit as f64).ceil() as i64).max(1),
+      None => 1,
+    }
+  }))
 }
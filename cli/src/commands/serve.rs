@@ -0,0 +1,173 @@
+use std::collections::HashMap;
+use std::fs::{File, OpenOptions};
+use std::io::{self, BufRead, Read, Seek, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, JoinHandle};
+
+use anyhow::{Context, Result, bail};
+use argh::FromArgs;
+use serde::Deserialize;
+use serde_json::json;
+
+use crate::config::CONFIG;
+use crate::utils::{Frame, VERSION, capture, is_capturing, traffic, was_not_found, write_frame, write_logfile};
+use crate::{debug_log, execute, log};
+
+#[derive(Deserialize, Debug)]
+struct Request {
+  id: u64,
+  #[serde(default)]
+  args: Vec<String>,
+  #[serde(default)]
+  cancel: bool,
+  #[serde(default)]
+  idempotency_key: Option<String>,
+}
+
+// How many idempotency keys of applied requests are remembered
+const MAX_APPLIED: usize = 500;
+
+/// Run as a co-process answering newline-delimited JSON requests on stdin until it is closed.
+#[derive(FromArgs, PartialEq, Debug)]
+#[argh(subcommand, name = "serve")]
+pub struct Serve {
+  /// file remembering the idempotency keys of applied requests, requests with a key are run every time without it
+  #[argh(option)]
+  applied: Option<PathBuf>,
+}
+
+// Requests are JSON objects, one per line. Responses are frames as described by `write_frame`: any number of `L` (log
+// line) and `P` (partial result or progress event) frames, at most one `R` (result) frame and finally an `E` frame with
+// the `exit_code` and `stderr` of the request along with how many `requests` and `bytes` it sent to Hardcover.app. A
+// request of the form `{"id":N,"cancel":true}` asks request N to stop before its next network request, it still gets
+// its `E` frame.
+pub fn run(args: &Serve) -> Result<()> {
+  if is_capturing() {
+    bail!("<i>serve</i> can not be requested from a co-process");
+  }
+
+  debug_log!("{} {:?}", &*VERSION, args)?;
+
+  let mut handles: Vec<JoinHandle<()>> = Vec::new();
+  let running: Arc<Mutex<HashMap<u64, Arc<AtomicBool>>>> = Arc::default();
+
+  for line in io::stdin().lock().lines() {
+    let line = line.context("Failed to read request")?;
+    if line.trim().is_empty() {
+      continue;
+    }
+
+    match serde_json::from_str::<Request>(&line) {
+      Ok(request) if request.cancel => {
+        if let Some(cancelled) = running.lock().unwrap().get(&request.id) {
+          cancelled.store(true, Ordering::Relaxed);
+        }
+      }
+      Ok(request) => {
+        let cancelled = Arc::new(AtomicBool::new(false));
+        running.lock().unwrap().insert(request.id, cancelled.clone());
+
+        let running = running.clone();
+        let applied = args.applied.clone();
+        handles.retain(|handle| !handle.is_finished());
+        handles.push(thread::spawn(move || {
+          respond(&request, cancelled, applied.as_deref());
+          running.lock().unwrap().remove(&request.id);
+        }));
+      }
+      Err(e) => debug_log!("Ignoring malformed request {line}: {e}")?,
+    }
+  }
+
+  for handle in handles {
+    let _ = handle.join();
+  }
+
+  Ok(())
+}
+
+fn respond(request: &Request, cancelled: Arc<AtomicBool>, applied: Option<&Path>) {
+  let key = applied.zip(request.idempotency_key.as_deref());
+
+  let (exit_code, stderr) = capture(request.id, cancelled, || {
+    if let Some((applied, key)) = key
+      && is_applied(applied, key)
+    {
+      log!("Skipping request {key}, it was already applied").expect("Failed to log skipped request");
+      return;
+    }
+
+    execute(&request.args.iter().map(String::as_str).collect::<Vec<_>>());
+
+    if CONFIG.debug {
+      write_logfile();
+    }
+  });
+
+  // A book that wasn't found means nothing was changed, it is sent again once the book is linked
+  if let Some((applied, key)) = key
+    && exit_code == 0
+    && !was_not_found()
+    && let Err(e) = mark_applied(applied, key)
+  {
+    let _ = debug_log!("Failed to remember request {key}: {e:#}");
+  }
+  let (requests, bytes) = traffic();
+
+  write_frame(
+    Frame::Exit,
+    request.id,
+    json!({
+      "exit_code": exit_code,
+      "stderr": stderr,
+      "requests": requests,
+      "bytes": bytes,
+    })
+    .to_string()
+    .as_bytes(),
+  );
+}
+
+/// Open the file of applied requests locked, a retired co-process may still be finishing requests and writing to it.
+fn lock_applied(path: &Path) -> Result<File> {
+  let file = OpenOptions::new()
+    .read(true)
+    .write(true)
+    .create(true)
+    .truncate(false)
+    .open(path)
+    .context("Failed to open applied requests")?;
+  file.lock().context("Failed to lock applied requests")?;
+
+  Ok(file)
+}
+
+fn read_applied(file: &mut File) -> Result<String> {
+  let mut applied = String::new();
+  file.read_to_string(&mut applied).context("Failed to read applied requests")?;
+
+  Ok(applied)
+}
+
+/// Whether a request with this idempotency key already went through, the hook may not have heard back from it.
+fn is_applied(path: &Path, key: &str) -> bool {
+  lock_applied(path)
+    .and_then(|mut file| read_applied(&mut file))
+    .is_ok_and(|applied| applied.lines().any(|line| line == key))
+}
+
+fn mark_applied(path: &Path, key: &str) -> Result<()> {
+  let mut file = lock_applied(path)?;
+
+  let mut applied = read_applied(&mut file)?.lines().map(String::from).collect::<Vec<_>>();
+  applied.push(key.to_string());
+
+  let skip = applied.len().saturating_sub(MAX_APPLIED);
+  file.set_len(0).context("Failed to write applied requests")?;
+  file.rewind().context("Failed to write applied requests")?;
+  file
+    .write_all(applied[skip..].iter().map(|line| format!("{line}\n")).collect::<String>().as_bytes())
+    .context("Failed to write applied requests")
+}
@@ -20,7 +20,7 @@ use crate::utils::{GraphQLQueryExt, VERSION, normalize_identifiers};
   response_derives = "Debug,AggregateErrors",
   variables_derives = "Debug"
 )]
-struct UpdateRead;
+pub struct UpdateRead;
 
 #[derive(GraphQLQuery)]
 #[graphql(
@@ -30,7 +30,7 @@ struct UpdateRead;
   response_derives = "Debug,AggregateErrors",
   variables_derives = "Debug"
 )]
-struct InsertRead;
+pub struct InsertRead;
 
 /// Update read percentage and create journal entries for bookmarks.
 #[derive(FromArgs, PartialEq, Debug)]
@@ -65,7 +65,7 @@ pub fn run(args: &Update) -> Result<()> {
   )?;
   let started_at = started_at.unwrap_or(Local::now().format("%Y-%m-%d").to_string());
 
-  let progress_pages = (pages as f64 * (args.value as f64 / 100.0)).round() as i64;
+  let progress_pages = progress_pages(pages, args.value);
 
   if let Some(user_read_id) = user_read_id {
     log!("Update read `{user_read_id}` for edition `{edition_id}` to page `{progress_pages}`")?;
@@ -87,9 +87,7 @@ pub fn run(args: &Update) -> Result<()> {
     })?;
   }
 
-  if CONFIG.sync_bookmarks == SyncBookmarks::Never
-    || (CONFIG.sync_bookmarks == SyncBookmarks::Finished && args.value != 100)
-  {
+  if !should_sync_bookmarks(args.value) {
     return Ok(());
   }
 
@@ -97,3 +95,11 @@ pub fn run(args: &Update) -> Result<()> {
 
   Ok(())
 }
+
+pub fn progress_pages(pages: i64, value: i64) -> i64 {
+  (pages as f64 * (value as f64 / 100.0)).round() as i64
+}
+
+pub fn should_sync_bookmarks(value: i64) -> bool {
+  CONFIG.sync_bookmarks == SyncBookmarks::Always || (CONFIG.sync_bookmarks == SyncBookmarks::Finished && value == 100)
+}
@@ -0,0 +1,210 @@
+use anyhow::{Context, Result, anyhow};
+use argh::FromArgs;
+use chrono::Local;
+use graphql_client::{GraphQLQuery, Response};
+use itertools::Itertools;
+use serde::Deserialize;
+use serde_json::{Value, json};
+
+use crate::commands::getuser::get_user;
+use crate::commands::getuserbook::{GetEdition, get_edition, pick_edition};
+use crate::commands::setuserbook::{update_or_insert_user_book, update_user_book::UserBookUpdateInput};
+use crate::commands::update::{InsertRead, UpdateRead, insert_read, progress_pages, should_sync_bookmarks, update_read};
+use crate::commands::updatejournal::update_journal;
+use crate::hardcover::send_batch;
+use crate::log;
+use crate::utils::{ItemError, VERSION, isolate, normalize_identifiers, send_result};
+
+#[derive(Deserialize, Debug)]
+struct Book {
+  content_id: String,
+  linked_id: Option<i64>,
+  value: i64,
+}
+
+/// Book found on Hardcover.app whose read is being updated.
+struct Resolved {
+  book_id: i64,
+  edition_id: i64,
+  pages: i64,
+}
+
+/// Update read percentage and create journal entries for several books in one go.
+#[derive(FromArgs, PartialEq, Debug)]
+#[argh(subcommand, name = "update-batch")]
+pub struct UpdateBatch {
+  /// json array of objects with the `content_id`, optional `linked_id` and `value` of each book
+  #[argh(option)]
+  books: String,
+}
+
+// Every book is looked up in one HTTP request and reads are updated or inserted in at most two more. Only marking a book
+// as currently reading, when it isn't yet, is still a request of its own. The result has an entry per book, in the
+// order given, with a `status` of `ok`, `book_not_found` or `error` and a `message` for the latter two.
+pub fn run(args: &UpdateBatch) -> Result<()> {
+  log!("{} {:?}", &*VERSION, args)?;
+
+  let books = serde_json::from_str::<Vec<Book>>(&args.books).context("Failed to parse <i>--books</i>")?;
+  let mut results = vec![json!({ "status": "ok" }); books.len()];
+  let mut resolved = books.iter().map(|_| None).collect::<Vec<Option<Resolved>>>();
+
+  let mut updates = Vec::new();
+  let mut inserts = Vec::new();
+
+  let user_id = get_user()?.id;
+  let (lookups, bodies): (Vec<_>, Vec<_>) = books
+    .iter()
+    .map(|book| {
+      let (linked_id, isbn) = normalize_identifiers(book.linked_id, Some(&book.content_id));
+      (
+        (isbn.join(", "), linked_id),
+        GetEdition::build_query(get_edition::Variables {
+          isbn,
+          linked_id,
+          user_id,
+        }),
+      )
+    })
+    .unzip();
+
+  log!("Looking up {} books", bodies.len())?;
+
+  let editions = match send_batch::<_, Response<get_edition::ResponseData>>(get_edition::OPERATION_NAME, &bodies) {
+    Ok(responses) => responses
+      .into_iter()
+      .map(|res| res.and_then(|res| res.data.context("GetEdition response is None")))
+      .collect(),
+    Err(e) => {
+      let message = format!("{:#}", e.chain().join("<br>> "));
+      books.iter().map(|_| Err(anyhow!(message.clone()))).collect::<Vec<_>>()
+    }
+  };
+
+  for (index, ((isbn_display, linked_id), edition)) in lookups.into_iter().zip(editions).enumerate() {
+    let book = &books[index];
+    let res = isolate(|| {
+      let (hardcover_book, edition_id, pages) = pick_edition(edition?, &isbn_display, linked_id)?;
+      let book_id = hardcover_book.id;
+      let (user_book_id, user_read_id, started_at) = update_or_insert_user_book(
+        hardcover_book,
+        edition_id,
+        UserBookUpdateInput {
+          status_id: Some(2),
+          ..UserBookUpdateInput::default()
+        },
+      )?;
+      let started_at = started_at.unwrap_or(Local::now().format("%Y-%m-%d").to_string());
+      let progress_pages = progress_pages(pages, book.value);
+
+      if let Some(user_read_id) = user_read_id {
+        log!("Update read `{user_read_id}` for edition `{edition_id}` to page `{progress_pages}`")?;
+        updates.push((
+          index,
+          UpdateRead::build_query(update_read::Variables {
+            id: user_read_id,
+            progress_pages,
+            edition_id,
+            started_at,
+          }),
+        ));
+      } else {
+        log!("Insert new read for edition `{edition_id}` at page `{progress_pages}`")?;
+        inserts.push((
+          index,
+          InsertRead::build_query(insert_read::Variables {
+            user_book_id,
+            edition_id,
+            progress_pages,
+            started_at,
+          }),
+        ));
+      }
+
+      Ok(Resolved {
+        book_id,
+        edition_id,
+        pages,
+      })
+    });
+
+    match res {
+      Ok(book) => resolved[index] = Some(book),
+      Err(e) => results[index] = item_error(e),
+    }
+  }
+
+  log!("Sending {} read updates and {} new reads", updates.len(), inserts.len())?;
+
+  let mut failed = Vec::new();
+
+  if !updates.is_empty() {
+    let (indexes, bodies): (Vec<_>, Vec<_>) = updates.into_iter().unzip();
+    failed.extend(batch_failures(
+      indexes,
+      send_batch::<_, Response<update_read::ResponseData>>(update_read::OPERATION_NAME, &bodies),
+    ));
+  }
+
+  if !inserts.is_empty() {
+    let (indexes, bodies): (Vec<_>, Vec<_>) = inserts.into_iter().unzip();
+    failed.extend(batch_failures(
+      indexes,
+      send_batch::<_, Response<insert_read::ResponseData>>(insert_read::OPERATION_NAME, &bodies),
+    ));
+  }
+
+  for (index, message) in failed {
+    results[index] = json!({ "status": "error", "message": message });
+    resolved[index] = None;
+  }
+
+  for (book, resolved) in books.iter().zip(&resolved) {
+    let Some(resolved) = resolved else {
+      continue;
+    };
+
+    if !should_sync_bookmarks(book.value) {
+      continue;
+    }
+
+    // The read is already updated so failing to sync bookmarks doesn't fail the book
+    if let Err(ItemError::BookNotFound(message) | ItemError::Failed(message)) =
+      isolate(|| update_journal(&book.content_id, resolved.book_id, resolved.edition_id, resolved.pages))
+    {
+      log!("Failed to sync bookmarks for `{}`: {message}", book.content_id)?;
+    }
+  }
+
+  send_result(&json!({
+    "results": books
+      .iter()
+      .zip(results)
+      .map(|(book, mut result)| {
+        result["content_id"] = json!(book.content_id);
+        result
+      })
+      .collect::<Vec<_>>()
+  }))
+}
+
+fn item_error(e: ItemError) -> Value {
+  match e {
+    ItemError::BookNotFound(message) => json!({ "status": "book_not_found", "message": message }),
+    ItemError::Failed(message) => json!({ "status": "error", "message": message }),
+  }
+}
+
+/// Match the operations that failed in a batch back to the books they were sent for.
+fn batch_failures<R>(indexes: Vec<usize>, responses: Result<Vec<Result<R>>>) -> Vec<(usize, String)> {
+  match responses {
+    Ok(responses) => indexes
+      .into_iter()
+      .zip(responses)
+      .filter_map(|(index, res)| res.err().map(|e| (index, format!("{:#}", e.chain().join("<br>> ")))))
+      .collect(),
+    Err(e) => {
+      let message = format!("{:#}", e.chain().join("<br>> "));
+      indexes.into_iter().map(|index| (index, message.clone())).collect()
+    }
+  }
+}
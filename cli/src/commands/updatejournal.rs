@@ -14,7 +14,7 @@ use crate::commands::getuserbook::get_book;
 use crate::config::{CONFIG, SyncBookmarks};
 use crate::database::{Bookmark, get_bookmarks};
 use crate::hardcover::send_request;
-use crate::utils::{GraphQLQueryExt, VERSION, normalize_identifiers};
+use crate::utils::{GraphQLQueryExt, VERSION, normalize_identifiers, send_partial};
 use crate::{debug_log, log};
 
 #[derive(GraphQLQuery)]
@@ -129,6 +129,10 @@ pub fn update_journal(content_id: &str, book_id: i64, edition_id: i64, pages: i6
       )
     });
 
+  let update_bookmarks = update_bookmarks.into_iter().flatten().collect::<Vec<_>>();
+  let total = insert_bookmarks.len() + update_bookmarks.len();
+  let mut done = 0;
+
   if !insert_bookmarks.is_empty() {
     log!(
       "Insert {} quotes for book `{}` and edition `{}`",
@@ -148,11 +152,12 @@ pub fn update_journal(content_id: &str, book_id: i64, edition_id: i64, pages: i6
         insert_reading_journal::OPERATION_NAME,
         chunk,
       )?;
+
+      done += chunk.len();
+      send_partial(&json!({ "done": done, "total": total }))?;
     }
   }
 
-  let update_bookmarks = update_bookmarks.into_iter().flatten().collect::<Vec<_>>();
-
   if !update_bookmarks.is_empty() {
     log!(
       "Update {} quotes for book `{}` and edition `{}`",
@@ -172,6 +177,9 @@ pub fn update_journal(content_id: &str, book_id: i64, edition_id: i64, pages: i6
         update_reading_journal::OPERATION_NAME,
         chunk,
       )?;
+
+      done += chunk.len();
+      send_partial(&json!({ "done": done, "total": total }))?;
     }
   }
 
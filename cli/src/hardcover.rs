@@ -15,7 +15,7 @@ use ureq::{
 };
 
 use crate::config::CONFIG;
-use crate::utils::{AggregateErrors, VERSION};
+use crate::utils::{AggregateErrors, VERSION, is_cancelled, record_traffic};
 use crate::{debug_log, log};
 
 pub mod scalars {
@@ -44,10 +44,14 @@ fn try_request<T: Serialize>(request_body: &T) -> Result<Response<Body>> {
       .into()
   });
 
+  let body = serde_json::to_vec(request_body).context("Failed to serialize request")?;
+  record_traffic(1, body.len());
+
   let res = CLIENT
     .post("https://api.hardcover.app/v1/graphql")
     .header("authorization", &CONFIG.authorization)
-    .send_json(request_body)
+    .header("content-type", "application/json")
+    .send(&body[..])
     .context("Failed to send request")?;
 
   match res.status() {
@@ -94,26 +98,39 @@ fn try_request<T: Serialize>(request_body: &T) -> Result<Response<Body>> {
   Ok(res)
 }
 
-pub fn send_request<T: Serialize, R: DeserializeOwned + Debug + AggregateErrors>(
-  operation_name: &str,
-  request_body: T,
-) -> Result<R> {
+fn send<T: Serialize, R: DeserializeOwned + Debug>(operation_name: &str, request_body: T) -> Result<R> {
   assert!(
     !CONFIG.authorization.is_empty(),
     "Please set the Hardcover.app authorization token in <i>.adds/NickelHardcover/config.ini</i>."
   );
 
-  let data = retry(Exponential::from_millis(10).map(jitter).take(3), || {
+  // Nobody is waiting for the result anymore so don't spend the network on it
+  assert!(!is_cancelled(), "<i>{operation_name}</i> request cancelled");
+
+  let body = retry(Exponential::from_millis(10).map(jitter).take(3), || {
     try_request(&request_body)
   })
   .map_err(|err| err.error)
   .context(format!("<i>{operation_name}</i> request failed"))?
   .body_mut()
-  .read_json::<R>()
-  .context(format!("Failed to parse <i>{operation_name}</i> response"))?;
+  .read_to_string()
+  .context(format!("Failed to read <i>{operation_name}</i> response"))?;
+  record_traffic(0, body.len());
+
+  let data =
+    serde_json::from_str::<R>(&body).context(format!("Failed to parse <i>{operation_name}</i> response"))?;
 
   debug_log!("{:?}", data)?;
 
+  Ok(data)
+}
+
+pub fn send_request<T: Serialize, R: DeserializeOwned + Debug + AggregateErrors>(
+  operation_name: &str,
+  request_body: T,
+) -> Result<R> {
+  let data = send::<T, R>(operation_name, request_body)?;
+
   let errors = data.errors().join("<br>>");
   if !errors.is_empty() {
     bail!("{operation_name} has errors<br>{errors}");
@@ -121,3 +138,33 @@ pub fn send_request<T: Serialize, R: DeserializeOwned + Debug + AggregateErrors>
 
   Ok(data)
 }
+
+/// Send several operations in a single HTTP request. Unlike `send_request` each operation succeeds or fails on its own.
+pub fn send_batch<T: Serialize, R: DeserializeOwned + Debug + AggregateErrors>(
+  operation_name: &str,
+  request_bodies: &[T],
+) -> Result<Vec<Result<R>>> {
+  let data = send::<_, Vec<R>>(operation_name, request_bodies)?;
+
+  if data.len() != request_bodies.len() {
+    bail!(
+      "{operation_name} returned {} responses for {} operations",
+      data.len(),
+      request_bodies.len()
+    );
+  }
+
+  Ok(
+    data
+      .into_iter()
+      .map(|data| {
+        let errors = data.errors().join("<br>>");
+        if errors.is_empty() {
+          Ok(data)
+        } else {
+          Err(anyhow::anyhow!("{operation_name} has errors<br>{errors}"))
+        }
+      })
+      .collect(),
+  )
+}
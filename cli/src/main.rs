@@ -2,11 +2,13 @@ use std::env;
 use std::panic;
 
 use crate::commands::listbookmarks;
+use crate::commands::listcontent;
 use crate::commands::listeditions;
+use crate::commands::updatebatch;
 use crate::commands::updatejournal;
-use crate::commands::{getuser, getuserbook, insertjournal, listjournal, search, setuserbook, update};
+use crate::commands::{getuser, getuserbook, insertjournal, listjournal, search, serve, setuserbook, update};
 use crate::config::CONFIG;
-use crate::utils::{VERSION, write_logfile};
+use crate::utils::{VERSION, is_capturing, write_logfile};
 
 mod commands;
 mod hardcover;
@@ -37,11 +39,14 @@ enum Commands {
   GetUserBook(getuserbook::GetUserBook),
   InsertJournal(insertjournal::InsertJournal),
   ListBookmarks(listbookmarks::ListBookmarks),
+  ListContent(listcontent::ListContent),
   ListEditions(listeditions::ListEditions),
   ListJournal(listjournal::ListJournal),
   Search(search::Search),
+  Serve(serve::Serve),
   SetUserBook(setuserbook::SetUserBook),
   Update(update::Update),
+  UpdateBatch(updatebatch::UpdateBatch),
   UpdateJournal(updatejournal::UpdateJournal),
 }
 
@@ -49,7 +54,9 @@ fn main() {
   if env::var("RUST_BACKTRACE").is_err() {
     panic::set_hook(Box::new(|info| {
       let msg = info.payload_as_str().unwrap_or("An unknown error occurred");
-      eprintln!("{msg}");
+      if !is_capturing() {
+        eprintln!("{msg}");
+      }
       if let Err(e) = debug_log!("{msg}") {
         eprintln!("{e}");
       }
@@ -64,6 +71,18 @@ fn main() {
     return;
   }
 
+  run(args);
+}
+
+/// Run a single command as if it had been passed on the command line.
+pub fn execute(args: &[&str]) {
+  match Arguments::from_args(&[env!("CARGO_PKG_NAME")], args) {
+    Ok(args) => run(args),
+    Err(e) => panic!("{}", e.output),
+  }
+}
+
+fn run(args: Arguments) {
   let res = match args
     .command
     .expect("A subcommands must be present. Run with --help for more information.")
@@ -72,11 +91,14 @@ fn main() {
     Commands::GetUserBook(args) => getuserbook::run(&args),
     Commands::InsertJournal(args) => insertjournal::run(args),
     Commands::ListBookmarks(args) => listbookmarks::run(&args),
+    Commands::ListContent(args) => listcontent::run(&args),
     Commands::ListEditions(args) => listeditions::run(args),
     Commands::ListJournal(args) => listjournal::run(&args),
     Commands::Search(args) => search::run(args),
+    Commands::Serve(args) => serve::run(&args),
     Commands::SetUserBook(args) => setuserbook::run(args),
     Commands::Update(args) => update::run(&args),
+    Commands::UpdateBatch(args) => updatebatch::run(&args),
     Commands::UpdateJournal(args) => updatejournal::run(&args),
   };
 
@@ -87,7 +109,7 @@ fn main() {
     );
   }
 
-  if CONFIG.debug {
+  if CONFIG.debug && !is_capturing() {
     write_logfile();
   }
 }
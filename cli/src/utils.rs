@@ -1,12 +1,18 @@
+use std::any::Any;
+use std::cell::{Cell, RefCell};
 use std::fmt::Debug;
 use std::fmt::Write;
 use std::fs::write;
-use std::sync::{LazyLock, Mutex};
+use std::io::{self, Write as _};
+use std::panic::{self, AssertUnwindSafe, UnwindSafe};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, LazyLock};
 
 use anyhow::{Context, Result};
 use chrono::Local;
 use graphql_client::{GraphQLQuery, Response};
 use itertools::Itertools;
+use serde_json::{Value, json};
 
 use crate::config::CONFIG;
 use crate::database::get_sqlite_isbn;
@@ -26,31 +32,188 @@ macro_rules! debug_log {
 macro_rules! log {
   ($($t:tt)*) => {{
     let msg = format!($($t)*);
-    println!("{msg}");
+    crate::utils::print(&msg);
     crate::utils::debug_log(&msg)
   }};
 }
 
 pub static VERSION: LazyLock<&str> = LazyLock::new(|| option_env!("VERSION").unwrap_or(env!("CARGO_PKG_VERSION")));
 
-static LOG: LazyLock<Mutex<String>> = LazyLock::new(|| Mutex::new(String::new()));
+thread_local! {
+  static LOG: RefCell<String> = const { RefCell::new(String::new()) };
+
+  // Id of the request currently running on this thread when serving requests
+  static REQUEST: Cell<Option<u64>> = const { Cell::new(None) };
+
+  // Set once the hook no longer wants the result of the request running on this thread
+  static CANCELLED: RefCell<Option<Arc<AtomicBool>>> = const { RefCell::new(None) };
+
+  // Hardcover.app requests sent and bytes moved by the request running on this thread
+  static TRAFFIC: Cell<(u64, u64)> = const { Cell::new((0, 0)) };
+
+  // Whether the request running on this thread ended because its book wasn't found
+  static NOT_FOUND: Cell<bool> = const { Cell::new(false) };
+
+  // Set while running one item of a batch
+  static ISOLATED: Cell<bool> = const { Cell::new(false) };
+}
+
+/// Panic payload used to end a request or batch item early without reporting an error.
+pub struct BookNotFound(pub String);
+
+/// Why a single item of a batch failed.
+pub enum ItemError {
+  BookNotFound(String),
+  Failed(String),
+}
 
 pub fn debug_log(msg: &str) -> Result<()> {
-  writeln!(LOG.lock().unwrap(), "{} {msg}", Local::now().format("%c")).context("Failed to write to log")
+  LOG.with_borrow_mut(|log| writeln!(log, "{} {msg}", Local::now().format("%c"))).context("Failed to write to log")
+}
+
+pub fn print(msg: &str) {
+  match REQUEST.get() {
+    Some(id) => write_frame(Frame::Log, id, msg.as_bytes()),
+    None => println!("{msg}"),
+  }
+}
+
+/// Kinds of frames written to stdout while serving requests.
+#[derive(Clone, Copy)]
+pub enum Frame {
+  /// A log line as plain text.
+  Log,
+  /// The JSON result of a command.
+  Result,
+  /// A JSON progress event or part of the result sent ahead of the rest.
+  Partial,
+  /// A JSON object with the `exit_code` and `stderr` of a finished request.
+  Exit,
+}
+
+/// Write a frame to stdout without interleaving with other threads. Each frame is a header line made of the frame
+/// kind, the request id and the payload length in bytes, followed by the payload itself so the reader never has to
+/// look inside it.
+pub fn write_frame(kind: Frame, id: u64, payload: &[u8]) {
+  let kind = match kind {
+    Frame::Log => 'L',
+    Frame::Result => 'R',
+    Frame::Partial => 'P',
+    Frame::Exit => 'E',
+  };
+
+  let mut out = io::stdout().lock();
+  if let Err(e) = write!(out, "{kind} {id} {}\n", payload.len())
+    .and_then(|()| out.write_all(payload))
+    .and_then(|()| out.flush())
+  {
+    eprintln!("Failed to write to stdout: {e}");
+  }
+}
+
+/// Send the result of a command, standalone runs print it after a `BEGIN_JSON` line.
+pub fn send_result(result: &Value) -> Result<()> {
+  debug_log!("BEGIN_JSON\n{result}")?;
+
+  match REQUEST.get() {
+    Some(id) => write_frame(Frame::Result, id, result.to_string().as_bytes()),
+    None => println!("BEGIN_JSON\n{result}"),
+  }
+
+  Ok(())
+}
+
+/// Send part of the result or a progress event ahead of the result. Only the co-process has someone listening.
+pub fn send_partial(partial: &Value) -> Result<()> {
+  debug_log!("{partial}")?;
+
+  if let Some(id) = REQUEST.get() {
+    write_frame(Frame::Partial, id, partial.to_string().as_bytes());
+  }
+
+  Ok(())
+}
+
+pub fn is_capturing() -> bool {
+  REQUEST.get().is_some()
+}
+
+/// Run `f` as request `id`, streaming everything it logs and returning the exit code and error message it would
+/// have produced as a standalone process.
+pub fn capture(id: u64, cancelled: Arc<AtomicBool>, f: impl FnOnce() + UnwindSafe) -> (i32, String) {
+  REQUEST.set(Some(id));
+  CANCELLED.set(Some(cancelled));
+  TRAFFIC.set((0, 0));
+  NOT_FOUND.set(false);
+  let res = panic::catch_unwind(f);
+  CANCELLED.set(None);
+  REQUEST.set(None);
+
+  match res {
+    Ok(()) => (0, String::new()),
+    Err(payload) if payload.is::<BookNotFound>() => {
+      NOT_FOUND.set(true);
+      (0, String::new())
+    }
+    Err(payload) => (1, panic_message(&*payload).to_string()),
+  }
+}
+
+/// Count network traffic towards the request running on this thread.
+pub fn record_traffic(requests: u64, bytes: usize) {
+  let (total_requests, total_bytes) = TRAFFIC.get();
+  TRAFFIC.set((total_requests + requests, total_bytes + bytes as u64));
+}
+
+/// Hardcover.app requests sent and bytes moved by the last request captured on this thread.
+pub fn traffic() -> (u64, u64) {
+  TRAFFIC.get()
+}
+
+/// Whether the last request captured on this thread ended in a `BOOK_NOT_FOUND` result.
+pub fn was_not_found() -> bool {
+  NOT_FOUND.get()
+}
+
+/// Run one item of a batch so a book that can't be found or an error only fails that item.
+pub fn isolate<T>(f: impl FnOnce() -> Result<T>) -> std::result::Result<T, ItemError> {
+  let isolated = ISOLATED.replace(true);
+  let res = panic::catch_unwind(AssertUnwindSafe(f));
+  ISOLATED.set(isolated);
+
+  match res {
+    Ok(Ok(value)) => Ok(value),
+    Ok(Err(e)) => Err(ItemError::Failed(format!("{:#}", e.chain().join("<br>> ")))),
+    Err(payload) => match payload.downcast::<BookNotFound>() {
+      Ok(not_found) => Err(ItemError::BookNotFound(not_found.0)),
+      Err(payload) => Err(ItemError::Failed(panic_message(&*payload).to_string())),
+    },
+  }
+}
+
+/// Whether the request running on this thread has been cancelled.
+pub fn is_cancelled() -> bool {
+  CANCELLED.with_borrow(|cancelled| cancelled.as_ref().is_some_and(|c| c.load(Ordering::Relaxed)))
+}
+
+pub fn panic_message(payload: &(dyn Any + Send)) -> &str {
+  payload
+    .downcast_ref::<&str>()
+    .copied()
+    .or_else(|| payload.downcast_ref::<String>().map(String::as_str))
+    .unwrap_or("An unknown error occurred")
 }
 
 pub fn write_logfile() {
   let res = || -> Result<()> {
-    write(
-      std::env::current_exe()
-        .context("Failed to get current binary path")?
-        .as_path()
-        .parent()
-        .context("Failed to get current binary directory")?
-        .join(Local::now().format("nickelhardcover_%Y-%m-%d_%H-%M-%S.log").to_string()),
-      LOG.lock().unwrap().as_str(),
-    )
-    .context("Failed to write log file")
+    let path = std::env::current_exe()
+      .context("Failed to get current binary path")?
+      .as_path()
+      .parent()
+      .context("Failed to get current binary directory")?
+      .join(Local::now().format("nickelhardcover_%Y-%m-%d_%H-%M-%S.log").to_string());
+
+    LOG.with_borrow(|log| write(path, log)).context("Failed to write log file")
   }();
 
   if let Err(e) = res {
@@ -84,11 +247,17 @@ pub fn normalize_identifiers(linked_id: Option<i64>, content_id: Option<&str>) -
 }
 
 pub fn book_not_found(msg: &str) -> ! {
-  log!(
-    "BEGIN_JSON\n{{\"error_code\": \"BOOK_NOT_FOUND\", \"message\": \"{}\"}}",
-    msg
-  )
-  .expect("Failed to log `BOOK_NOT_FOUND` error");
+  // The rest of the batch still has to run and the whole batch has a single result
+  if ISOLATED.get() {
+    panic::resume_unwind(Box::new(BookNotFound(msg.to_string())));
+  }
+
+  send_result(&json!({ "error_code": "BOOK_NOT_FOUND", "message": msg }))
+    .expect("Failed to send `BOOK_NOT_FOUND` error");
+
+  if is_capturing() {
+    panic::resume_unwind(Box::new(BookNotFound(msg.to_string())));
+  }
 
   if CONFIG.debug {
     write_logfile();
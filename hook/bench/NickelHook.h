@@ -0,0 +1,6 @@
+#pragma once
+
+#include <QDebug>
+
+// Stands in for NickelHook so the parts of the hook that only need QtCore can be built and timed on the host
+#define nh_log(...) qDebug(__VA_ARGS__)
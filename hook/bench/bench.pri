@@ -0,0 +1,9 @@
+QT = core testlib
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+# The hook sources include NickelHook.h for logging, the stub in this directory stands in for it
+INCLUDEPATH += $$PWD $$PWD/../src
+
+HEADERS += $$PWD/../src/bookstore.h $$PWD/../src/diskwriter.h $$PWD/../src/recordlog.h
+SOURCES += $$PWD/../src/bookstore.cc $$PWD/../src/diskwriter.cc $$PWD/../src/recordlog.cc
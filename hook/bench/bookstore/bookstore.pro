@@ -0,0 +1,4 @@
+include(../bench.pri)
+
+TARGET = bookstorebench
+SOURCES += bookstorebench.cc
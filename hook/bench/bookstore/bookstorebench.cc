@@ -0,0 +1,68 @@
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "bookstore.h"
+#include "diskwriter.h"
+
+static QString contentId(int i) { return QString("file:///mnt/onboard/Books/book-%1.epub").arg(i); }
+
+// The per-book half of Settings, what every isEnabled(), getLastProgress() and setLastProgress() goes through
+class BookStoreBench : public QObject {
+  Q_OBJECT
+
+private:
+  QTemporaryDir dir;
+  int nextFile = 0;
+
+  QString fill(int books) {
+    QString path = dir.filePath(QString("books-%1.log").arg(nextFile++));
+    BookStore store(path);
+
+    for (int i = 0; i < books; i++) {
+      store.set(contentId(i), {1, i % 100, QString::number(100000 + i)});
+    }
+
+    DiskWriter::getInstance()->flush(true);
+    return path;
+  }
+
+  void sizes() {
+    QTest::addColumn<int>("books");
+    QTest::newRow("100") << 100;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+  }
+
+private Q_SLOTS:
+  void get_data() { sizes(); }
+
+  void get() {
+    QFETCH(int, books);
+    BookStore store(fill(books));
+    QString id = contentId(books / 2);
+    store.get(id);
+
+    QBENCHMARK { store.get(id); }
+  }
+
+  void set_data() { sizes(); }
+
+  // Read, change one field and write back, as Settings does for every setter
+  void set() {
+    QFETCH(int, books);
+    BookStore store(fill(books));
+    QString id = contentId(books / 2);
+
+    int progress = 0;
+    QBENCHMARK {
+      BookStore::Book book = store.get(id);
+      book.progress = ++progress % 100;
+      store.set(id, book);
+    }
+
+    DiskWriter::getInstance()->flush(true);
+  }
+};
+
+QTEST_GUILESS_MAIN(BookStoreBench)
+#include "bookstorebench.moc"
@@ -0,0 +1,4 @@
+include(../bench.pri)
+
+TARGET = recordlogbench
+SOURCES += recordlogbench.cc
@@ -0,0 +1,101 @@
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "diskwriter.h"
+#include "recordlog.h"
+
+// Sized like books.log entries, a content id and a few bytes of state
+static QByteArray key(int i) { return QString("file:///mnt/onboard/Books/book-%1.epub").arg(i).toUtf8(); }
+static QByteArray value(int i) { return QByteArray(5, char(i)).append(QByteArray::number(i)); }
+
+class RecordLogBench : public QObject {
+  Q_OBJECT
+
+private:
+  QTemporaryDir dir;
+  int nextFile = 0;
+
+  QString path() { return dir.filePath(QString("bench-%1.log").arg(nextFile++)); }
+
+  // Fills a log with the given number of books, each updated a few times, and waits until it is on disk
+  QString fill(int books, int updates) {
+    QString file = path();
+    RecordLog log(file);
+
+    for (int round = 0; round <= updates; round++) {
+      for (int i = 0; i < books; i++) {
+        log.put(key(i), value(i + round));
+      }
+    }
+
+    DiskWriter::getInstance()->flush(true);
+    return file;
+  }
+
+private Q_SLOTS:
+  void append_data() {
+    QTest::addColumn<int>("books");
+    QTest::newRow("100") << 100;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+  }
+
+  // One change to a book already in the log, the cost paid on the GUI thread for every synced page turn
+  void append() {
+    QFETCH(int, books);
+    RecordLog log(fill(books, 0));
+    log.entries();
+
+    int round = 0;
+    QBENCHMARK {
+      round++;
+      for (int i = 0; i < books; i++) {
+        log.put(key(i), value(i + round));
+      }
+    }
+
+    DiskWriter::getInstance()->flush(true);
+  }
+
+  void load_data() {
+    QTest::addColumn<int>("books");
+    QTest::addColumn<int>("updates");
+    QTest::newRow("100") << 100 << 0;
+    QTest::newRow("1k") << 1000 << 0;
+    QTest::newRow("10k") << 10000 << 0;
+    QTest::newRow("1k, 2 updates each") << 1000 << 2;
+  }
+
+  void load() {
+    QFETCH(int, books);
+    QFETCH(int, updates);
+    QString file = fill(books, updates);
+
+    QBENCHMARK {
+      RecordLog log(file);
+      QCOMPARE(log.entries().size(), books);
+    }
+  }
+
+  void compact_data() {
+    QTest::addColumn<int>("books");
+    QTest::newRow("100") << 100;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+  }
+
+  // Includes writing the compacted log out, which happens on the writer thread on the Kobo
+  void compact() {
+    QFETCH(int, books);
+    RecordLog log(fill(books, 2));
+    log.entries();
+
+    QBENCHMARK {
+      log.compact();
+      DiskWriter::getInstance()->flush(true);
+    }
+  }
+};
+
+QTEST_GUILESS_MAIN(RecordLogBench)
+#include "recordlogbench.moc"
@@ -0,0 +1,81 @@
+#include <NickelHook.h>
+
+#include "alarmscheduler.h"
+#include "settings.h"
+
+AlarmScheduler *AlarmScheduler::instance = nullptr;
+
+AlarmScheduler *AlarmScheduler::getInstance() {
+  if (instance == nullptr) {
+    instance = new AlarmScheduler();
+  };
+
+  return instance;
+};
+
+AlarmScheduler::AlarmScheduler(QObject *parent) : QObject(parent) {};
+
+// Cheap enough to call on every sample, the alarm is only set the first time
+void AlarmScheduler::arm() {
+  if (timer != nullptr)
+    return;
+
+  // Settings aren't read on construction as SyncController creates this while Settings may still need it
+  if (!watching) {
+    watching = true;
+    hour = Settings::getInstance()->getSyncDaily();
+    QObject::connect(Settings::getInstance(), &Settings::changed, this, &AlarmScheduler::settingsChanged);
+  }
+
+  if (hour >= 0) {
+    schedule();
+  }
+}
+
+const QDateTime &AlarmScheduler::getNext() const { return next; }
+
+void AlarmScheduler::settingsChanged() {
+  int syncDaily = Settings::getInstance()->getSyncDaily();
+  if (syncDaily == hour)
+    return;
+
+  hour = syncDaily;
+
+  // Move an alarm that is already set to the new hour
+  if (timer != nullptr) {
+    cancel();
+
+    if (hour >= 0) {
+      schedule();
+    }
+  }
+}
+
+void AlarmScheduler::timeout() {
+  nh_log("AlarmScheduler::timeout()");
+
+  cancel();
+  fired();
+}
+
+void AlarmScheduler::schedule() {
+  next = QDateTime::currentDateTime();
+  if (next.time().hour() >= hour) {
+    next = next.addDays(1);
+  }
+  next.setTime(QTime(hour, 0));
+  nh_log("Setting alarm for %s", qPrintable(next.toString()));
+
+  timer = construct_PowerTimer("NickelHardcover-alarm", this);
+  PowerTimer__fireAt(timer, next);
+  QObject::connect(timer, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+void AlarmScheduler::cancel() {
+  if (timer != nullptr) {
+    timer->deleteLater();
+    timer = nullptr;
+  }
+
+  next = QDateTime();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QDateTime>
+#include <QObject>
+
+#include "nickelhardcover.h"
+
+// Wakes the Kobo at the sync_daily hour once there is progress waiting to be synced
+class AlarmScheduler : public QObject {
+  Q_OBJECT
+
+public:
+  static AlarmScheduler *getInstance();
+
+  void arm();
+  const QDateTime &getNext() const;
+
+public Q_SLOTS:
+  void settingsChanged();
+  void timeout();
+
+Q_SIGNALS:
+  void fired();
+
+private:
+  AlarmScheduler(QObject *parent = nullptr);
+
+  static AlarmScheduler *instance;
+
+  void schedule();
+  void cancel();
+
+  PowerTimer *timer = nullptr;
+  QDateTime next;
+  int hour = -1;
+  bool watching = false;
+};
@@ -39,7 +39,10 @@ AnnotationsDialog::AnnotationsDialog() : Dialog("Annotations") {
   layout->addWidget(pages, 1);
   QObject::connect(pages, &PagedStack::requestPage, this, &AnnotationsDialog::requestPage);
 
-  CLI *cli = CLI::listBookmarks();
+  CLI::Options options;
+  options.owner = this;
+
+  CLI *cli = CLI::listBookmarks(options);
   QObject::connect(cli, &CLI::response, this, &AnnotationsDialog::response);
 }
 
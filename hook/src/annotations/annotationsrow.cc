@@ -72,10 +72,21 @@ void AnnotationsRow::tapped() {
   options.query = doc.value("title").toString() + " " + doc.value("author").toString();
 
   CLI *cli = CLI::updateJournal(options);
+  QObject::connect(cli, &CLI::partial, this, &AnnotationsRow::progress);
   QObject::connect(cli, &CLI::success, this, &AnnotationsRow::success);
   QObject::connect(cli, &CLI::failure, this, &AnnotationsRow::closeDialog);
 }
 
+// Journal entries are sent in chunks, each one reported as it is done
+void AnnotationsRow::progress(QJsonObject doc) {
+  if (dialog == nullptr)
+    return;
+
+  ConfirmationDialog__setText(dialog, QString("Syncing annotations with Hardcover.app... %1 of %2")
+                                          .arg(doc.value("done").toInt())
+                                          .arg(doc.value("total").toInt()));
+}
+
 void AnnotationsRow::success() {
   if (dialog == nullptr)
     return;
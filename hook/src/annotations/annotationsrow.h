@@ -11,6 +11,7 @@ public:
 
 public Q_SLOTS:
   void tapped();
+  void progress(QJsonObject doc);
   void success();
   void closeDialog();
 
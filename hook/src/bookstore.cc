@@ -0,0 +1,72 @@
+#include <QSet>
+#include <QtEndian>
+
+#include "bookstore.h"
+
+// Stored as whether auto-sync is enabled, the last synced progress as a little endian 32-bit integer and the linked id
+static const int BOOK_HEADER_SIZE = 1 + 4;
+
+BookStore::BookStore(QString path) : log(path) {}
+
+QByteArray BookStore::getKey(QString contentId) { return contentId.replace('/', '-').replace('\\', '-').toUtf8(); }
+
+QByteArray BookStore::encode(const Book &book) {
+  QByteArray value(BOOK_HEADER_SIZE, Qt::Uninitialized);
+  value[0] = book.enabled;
+  qToLittleEndian<qint32>(book.progress, reinterpret_cast<uchar *>(value.data() + 1));
+  return value.append(book.linkedId.toUtf8());
+}
+
+BookStore::Book BookStore::get(QString contentId) {
+  QByteArray value = log.value(getKey(contentId));
+  if (value.size() < BOOK_HEADER_SIZE)
+    return {ENABLED_UNSET, 0, QString()};
+
+  return {value.at(0), qFromLittleEndian<qint32>(reinterpret_cast<const uchar *>(value.constData() + 1)),
+          QString::fromUtf8(value.constData() + BOOK_HEADER_SIZE, value.size() - BOOK_HEADER_SIZE)};
+}
+
+void BookStore::set(QString contentId, const Book &book) {
+  if (book.enabled == ENABLED_UNSET && book.progress == 0 && book.linkedId.isEmpty()) {
+    log.remove(getKey(contentId));
+  } else {
+    log.put(getKey(contentId), encode(book));
+  }
+}
+
+int BookStore::count() { return log.entries().size(); }
+
+// Replace every book with a single write, keys are already named by getKey
+void BookStore::reset(QHash<QByteArray, Book> books) {
+  QHash<QByteArray, QByteArray> entries;
+  QHash<QByteArray, Book>::const_iterator i = books.constBegin();
+  while (i != books.constEnd()) {
+    entries.insert(i.key(), encode(i.value()));
+    ++i;
+  }
+
+  log.reset(entries);
+}
+
+// Drop every book not in the given list of books on the device and rewrite the store without them
+void BookStore::collectGarbage(QStringList contentIds, int &entries, qint64 &bytes) {
+  QSet<QByteArray> keys;
+  foreach (const QString &contentId, contentIds) {
+    keys.insert(getKey(contentId));
+  }
+
+  QHash<QByteArray, QByteArray> kept;
+  QHash<QByteArray, QByteArray>::const_iterator i = log.entries().constBegin();
+  while (i != log.entries().constEnd()) {
+    if (keys.contains(i.key())) {
+      kept.insert(i.key(), i.value());
+    }
+    ++i;
+  }
+
+  entries = log.entries().size() - kept.size();
+  bytes = log.size();
+
+  log.reset(kept);
+  bytes -= log.size();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include "recordlog.h"
+
+// What is stored for each book, one small record per book in a RecordLog. Kept apart from Settings so it only needs
+// QtCore.
+class BookStore {
+public:
+  struct Book {
+    char enabled;
+    int progress;
+    QString linkedId;
+  };
+
+  // Neither enabled nor disabled for the book, auto_sync_default decides
+  static const char ENABLED_UNSET = 2;
+
+  BookStore(QString path);
+
+  Book get(QString contentId);
+  void set(QString contentId, const Book &book);
+  int count();
+  void reset(QHash<QByteArray, Book> books);
+  void collectGarbage(QStringList contentIds, int &entries, qint64 &bytes);
+
+  static QByteArray getKey(QString contentId);
+
+private:
+  static QByteArray encode(const Book &book);
+
+  RecordLog log;
+};
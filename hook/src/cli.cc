@@ -1,14 +1,59 @@
 #include <QJsonDocument>
-#include <QProcess>
 #include <QTimer>
+#include <QUuid>
 
 #include <NickelHook.h>
 
 #include "cli.h"
+#include "cliprocess.h"
 #include "files.h"
+#include "networkbroker.h"
+#include "outbox.h"
 #include "search/searchdialog.h"
 #include "settings.h"
 #include "synccontroller.h"
+#include "wifisession.h"
+
+struct Command {
+  const char *name;
+  bool readOnly;
+  bool network;
+  bool durable; // Kept in the outbox when it can't reach Hardcover.app
+  int timeout;  // Milliseconds
+};
+
+// clang-format off
+static const Command commands[] = {
+  { .name = "get-user",       .readOnly = true,  .network = true,  .durable = false, .timeout = 30000  },
+  { .name = "get-user-book",  .readOnly = true,  .network = true,  .durable = false, .timeout = 30000  },
+  { .name = "insert-journal", .readOnly = false, .network = true,  .durable = true,  .timeout = 60000  },
+  { .name = "list-bookmarks", .readOnly = true,  .network = false, .durable = false, .timeout = 15000  }, // Only reads the Kobo database
+  { .name = "list-content",   .readOnly = true,  .network = false, .durable = false, .timeout = 15000  },
+  { .name = "list-editions",  .readOnly = true,  .network = true,  .durable = false, .timeout = 30000  },
+  { .name = "list-journal",   .readOnly = true,  .network = true,  .durable = false, .timeout = 30000  },
+  { .name = "search",         .readOnly = true,  .network = true,  .durable = false, .timeout = 20000  },
+  { .name = "set-user-book",  .readOnly = false, .network = true,  .durable = true,  .timeout = 60000  },
+  { .name = "update",         .readOnly = false, .network = true,  .durable = false, .timeout = 60000  }, // SyncQueue retries progress
+  { .name = "update-batch",   .readOnly = false, .network = true,  .durable = false, .timeout = 300000 },
+  { .name = "update-journal", .readOnly = false, .network = true,  .durable = true,  .timeout = 300000 }, // Uploads every annotation
+};
+// clang-format on
+
+// Used for anything missing from the table above
+static const int DEFAULT_TIMEOUT = 60000;
+
+static const Command *getCommand(QString name) {
+  for (const Command &command : commands) {
+    if (name == command.name) {
+      return &command;
+    }
+  }
+
+  return nullptr;
+}
+
+// Read-only requests still waiting on a response keyed by their arguments
+static QHash<QString, CLI *> inflight;
 
 QString CLI::Options::getContentId() {
   return contentId.isEmpty() ? SyncController::getInstance()->contentId : contentId;
@@ -19,7 +64,9 @@ QString CLI::Options::getQuery() {
   return query.isEmpty() ? ctl->title + " " + ctl->author : query;
 }
 
-CLI *CLI::listBookmarks(Options options) { return new CLI({"list-bookmarks"}, options); }
+CLI *CLI::listBookmarks(Options options) { return start({"list-bookmarks"}, options); }
+
+CLI *CLI::listContent(Options options) { return start({"list-content"}, options); }
 
 CLI *CLI::listEditions(QString bookId, int readingFormat, QString language, Options options) {
   QStringList arguments = {"list-editions", "--book-id", bookId};
@@ -32,40 +79,40 @@ CLI *CLI::listEditions(QString bookId, int readingFormat, QString language, Opti
     arguments.append({"--language", language});
   }
 
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::listJournal(int limit, int offset, Options options) {
   QStringList arguments = {"list-journal", "--limit", QString::number(limit), "--offset", QString::number(offset)};
   arguments.append(getIdentifier(options));
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::insertJournal(QString text, int percentage, QString privacy, Options options) {
   QStringList arguments = {"insert-journal", "--text", text, "--percentage", QString::number(percentage),
                            "--privacy",      privacy};
   arguments.append(getIdentifier(options));
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::updateJournal(Options options) {
   QStringList arguments = {"update-journal"};
   arguments.append(getIdentifier(options));
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
-CLI *CLI::getUser(Options options) { return new CLI({"get-user"}, options); }
+CLI *CLI::getUser(Options options) { return start({"get-user"}, options); }
 
 CLI *CLI::getUserBook(Options options) {
   QStringList arguments = {"get-user-book"};
   arguments.append(getIdentifier(options));
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::setUserBook(int status, Options options) {
   QStringList arguments = {"set-user-book", "--status", QString::number(status)};
   arguments.append(getIdentifier(options));
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::setUserBook(float rating, QString text, bool spoilers, bool sponsored, Options options) {
@@ -83,19 +130,23 @@ CLI *CLI::setUserBook(float rating, QString text, bool spoilers, bool sponsored,
     arguments.append({"--text", text});
   }
 
-  return new CLI(arguments, options);
+  return start(arguments, options);
 }
 
 CLI *CLI::search(QString query, int limit, int page, Options options) {
-  return new CLI({"search", "--limit", QString::number(limit), "--page", QString::number(page), "--query", query},
-                 options);
+  return start({"search", "--limit", QString::number(limit), "--page", QString::number(page), "--query", query},
+               options);
 }
 
 CLI *CLI::update(int percentage, Options options) {
   QStringList arguments = {"update", "--value", QString::number(percentage)};
   arguments.append(getIdentifier(options));
 
-  return new CLI(arguments, options);
+  return start(arguments, options);
+}
+
+CLI *CLI::updateBatch(QJsonArray books, Options options) {
+  return start({"update-batch", "--books", QJsonDocument(books).toJson(QJsonDocument::Compact)}, options);
 }
 
 QStringList CLI::getIdentifier(Options options) {
@@ -110,40 +161,140 @@ QStringList CLI::getIdentifier(Options options) {
   return identifiers;
 }
 
+CLI *CLI::replay(QStringList arguments, Options options) {
+  // The book may have been linked, or linked to another book, since the change was kept
+  int index = arguments.indexOf("--content-id");
+  if (index != -1) {
+    int end = index + (arguments.value(index + 2) == "--linked-id" ? 4 : 2);
+    arguments = arguments.mid(0, index) + getIdentifier(options) + arguments.mid(end);
+  }
+
+  return start(arguments, options);
+}
+
+CLI *CLI::start(QStringList arguments, Options options) {
+  const Command *command = getCommand(arguments.first());
+
+  // Lets the command line skip a mutation that already went through when it is sent again from the outbox
+  if (command != nullptr && command->durable && options.idempotencyKey.isEmpty()) {
+    options.idempotencyKey = QUuid::createUuid().toString().mid(1, 36);
+  }
+
+  if (command == nullptr || !command->readOnly) {
+    CLI *cli = new CLI(arguments, options);
+    cli->attach(options.owner);
+    return cli;
+  }
+
+  QString key = arguments.join(QChar(0x1f));
+
+  CLI *cli = inflight.value(key);
+  if (cli != nullptr) {
+    nh_log("Attaching to in-flight %s request", qPrintable(arguments.first()));
+    cli->attach(options.owner);
+    cli->promote(options);
+    return cli;
+  }
+
+  cli = new CLI(arguments, options);
+  cli->key = key;
+  cli->attach(options.owner);
+  inflight.insert(key, cli);
+
+  return cli;
+}
+
+void CLI::attach(QObject *owner) {
+  if (owner == nullptr) {
+    unowned++;
+    return;
+  }
+
+  owners.append(owner);
+  QObject::connect(owner, &QObject::destroyed, this, &CLI::ownerDestroyed);
+}
+
+// A request shared by several callers is as urgent and as visible as the most demanding of them
+void CLI::promote(Options options) {
+  if (done)
+    return;
+
+  if (!options.silent && this->options.silent) {
+    this->options.silent = false;
+
+    // Still waiting for the network, ask again so the user sees the prompt
+    if (id == 0) {
+      NetworkBroker::getInstance()->request(false);
+    }
+  }
+
+  if (options.priority == Priority::Interactive && this->options.priority == Priority::Background) {
+    this->options.priority = Priority::Interactive;
+
+    if (id > 0) {
+      CLIProcess::getInstance()->promote(id);
+    }
+  }
+}
+
+void CLI::detach(QObject *owner) {
+  if (!owners.removeOne(owner))
+    return;
+
+  QObject::disconnect(owner, &QObject::destroyed, this, &CLI::ownerDestroyed);
+  QObject::disconnect(this, nullptr, owner, nullptr);
+
+  if (owners.isEmpty() && unowned == 0) {
+    cancel();
+  }
+}
+
+void CLI::ownerDestroyed(QObject *owner) { detach(owner); }
+
+void CLI::cancel() {
+  if (done)
+    return;
+
+  nh_log("CLI::cancel() %s", qPrintable(arguments.first()));
+
+  done = true;
+  release();
+
+  if (id > 0) {
+    CLIProcess::getInstance()->cancel(id);
+  }
+
+  deleteLater();
+}
+
+void CLI::release() {
+  if (!key.isEmpty() && inflight.value(key) == this) {
+    inflight.remove(key);
+  }
+
+  key.clear();
+}
+
 CLI::CLI(QStringList arguments, Options options, QObject *parent)
     : QObject(parent), arguments(arguments), options(options) {
 
-  WirelessWorkflowManager *wfm = WirelessWorkflowManager__sharedInstance();
+  const Command *command = getCommand(arguments.first());
+  NetworkBroker *broker = NetworkBroker::getInstance();
 
-  if (WirelessWorkflowManager__isInternetAccessible(wfm)) {
+  if ((command != nullptr && !command->network) || broker->isAvailable()) {
     networkConnected();
   } else {
-    QObject::connect(wfm, SIGNAL(connectingFailed()), this, SLOT(connectingFailed()));
-
     showIcon(Files::wifi);
 
-    timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &CLI::connectingFailed);
-    timer->setSingleShot(true);
-    timer->start(30000);
-
-    WirelessManager *wm = WirelessManager__sharedInstance();
-    QObject::connect(wm, SIGNAL(networkConnected()), this, SLOT(networkConnected()));
-
-    // Yield to caller so signals can be setup before a possible connectingFailed() is triggered
-    QTimer::singleShot(0, this, [options] {
-      WirelessWorkflowManager *wfm = WirelessWorkflowManager__sharedInstance();
-
-      if (options.silent) {
-        WirelessWorkflowManager__connectWirelessSilently(wfm);
-      } else {
-        WirelessWorkflowManager__connectWireless(wfm, false, false);
-      }
-    });
+    QObject::connect(broker, &NetworkBroker::ready, this, &CLI::networkConnected);
+    QObject::connect(broker, &NetworkBroker::failed, this, &CLI::connectingFailed);
+    broker->request(options.silent);
   }
 }
 
 CLI::~CLI() {
+  release();
+
   if (icon != nullptr) {
     icon->deleteLater();
   }
@@ -152,14 +303,16 @@ CLI::~CLI() {
 void CLI::connectingFailed() {
   nh_log("CLI::connectingFailed()");
 
-  if (!options.silent) {
-    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", "Failed to connect to WIFI.");
-  }
+  if (done)
+    return;
+
+  // The broker already told the user it couldn't connect, only what happens to the change is left to say
+  done = true;
+  release();
 
-  if (timer != nullptr) {
-    timer->stop();
-    timer->deleteLater();
-    timer = nullptr;
+  if (keep() && !options.silent) {
+    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", "The change was saved and will be sent to "
+                                                                "Hardcover.app once connected.");
   }
 
   deleteLater();
@@ -182,93 +335,125 @@ void CLI::showIcon(const char *path) {
 void CLI::networkConnected() {
   nh_log("CLI::networkConnected()");
 
-  WirelessManager *wm = WirelessManager__sharedInstance();
-  QObject::disconnect(wm, SIGNAL(networkConnected()), this, SLOT(networkConnected()));
+  if (done)
+    return;
+
+  QObject::disconnect(NetworkBroker::getInstance(), nullptr, this, nullptr);
 
   if (options.icon) {
     showIcon(Files::icon);
   }
 
-  if (timer != nullptr) {
-    timer->stop();
-    timer->deleteLater();
-    timer = nullptr;
+  const Command *command = getCommand(arguments.first());
+  if (command == nullptr || command->network) {
+    WifiSession::getInstance()->busy();
   }
 
-  QProcess *process = new QProcess(this);
-  process->start(Files::cli, arguments);
-  QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &CLI::processFinished);
+  id = CLIProcess::getInstance()->send(arguments, this, options.priority,
+                                       command == nullptr ? DEFAULT_TIMEOUT : command->timeout, options.idempotencyKey);
 }
 
-void CLI::processFinished(int exitCode) {
-  QProcess *process = qobject_cast<QProcess *>(sender());
-
-  QByteArray stdout = process->readAllStandardOutput();
-
-  int index = stdout.indexOf("BEGIN_JSON");
-
-  QByteArray bytes = stdout;
-  if (index >= 0) {
-    bytes = stdout.left(index);
-  }
-
-  QList<QByteArray> lines = bytes.split('\n');
-  for (QByteArray &line : lines) {
-    if (line.length() == 0)
-      continue;
+void CLI::received(QJsonObject doc) {
+  result = doc;
+  hasResult = true;
+}
 
-    nh_log("%s", qPrintable(line));
-  }
+void CLI::finished(int exitCode, QString error) {
+  done = true;
+  release();
 
   if (exitCode > 0) {
-    QByteArray stderr = process->readAllStandardError();
-    nh_log("Error from command line \"%s\"", qPrintable(stderr));
-    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", QString(stderr));
+    nh_log("Error from command line \"%s\"", qPrintable(error));
+    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", error);
     failure(FailureReason::Error);
     deleteLater();
     return;
   }
 
-  if (index >= 0) {
-    QByteArray json = stdout.right(stdout.size() - index - 10);
-    QJsonObject obj = QJsonDocument::fromJson(json).object();
-
-    if (obj.value("error_code").toString() == "BOOK_NOT_FOUND") {
-      QString message = obj.value("message").toString();
+  if (hasResult) {
+    if (result.value("error_code").toString() == "BOOK_NOT_FOUND") {
+      QString message = result.value("message").toString();
       nh_log("%s", qPrintable(message));
 
-      ConfirmationDialog *dialog = ConfirmationDialogFactory__getConfirmationDialog(nullptr);
-      ConfirmationDialog__setAcceptButtonText(
-          dialog, Settings::getInstance()->getLinkedId(options.getContentId()).isEmpty() ? "Link book" : "Unlink book");
-      ConfirmationDialog__setRejectButtonText(dialog, "Cancel");
-      ConfirmationDialog__setTitle(dialog, "Hardcover.app");
-      ConfirmationDialog__setText(dialog, message);
-
-      QObject::connect(dialog, &QDialog::accepted, this, &CLI::linkBook);
-      QObject::connect(dialog, &QDialog::rejected, this, &CLI::deleteLater);
-      dialog->open();
+      QDialog *dialog = promptLink(options.getContentId(), options.getQuery(), message);
+      QObject::connect(dialog, &QDialog::finished, this, &CLI::deleteLater);
 
       failure(FailureReason::BookNotFound);
       return;
     }
 
-    response(obj);
+    response(result);
   }
 
   success();
   deleteLater();
 }
 
-void CLI::linkBook() {
-  nh_log("CLI::linkBook()");
+void CLI::timedOut() {
+  nh_log("CLI::timedOut() %s", qPrintable(arguments.first()));
 
-  QString contentId = options.getContentId();
+  done = true;
+  release();
 
-  if (Settings::getInstance()->getLinkedId(contentId).isEmpty()) {
-    SearchDialog::show(contentId, options.getQuery());
-  } else {
-    Settings::getInstance()->setLinkedId(contentId, QString());
+  bool kept = keep();
+
+  if (!options.silent) {
+    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", kept ? "Hardcover.app took too long to respond. The "
+                                                                       "change will be sent again later."
+                                                                     : "Hardcover.app took too long to respond.");
+  }
+
+  deleteLater();
+  failure(FailureReason::Timeout);
+}
+
+// The co-process was replaced while this was still running on it, whether it went through isn't known
+void CLI::interrupted() {
+  nh_log("CLI::interrupted() %s", qPrintable(arguments.first()));
+
+  done = true;
+  release();
+
+  bool kept = keep();
+
+  if (!options.silent) {
+    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", kept ? "The command line was restarted. The change "
+                                                                       "will be sent again later."
+                                                                     : "The command line was restarted.");
   }
 
   deleteLater();
+  failure(FailureReason::Timeout);
+}
+
+bool CLI::keep() {
+  const Command *command = getCommand(arguments.first());
+  if (command == nullptr || !command->durable)
+    return false;
+
+  Outbox::getInstance()->append(arguments, options.idempotencyKey, options.getContentId());
+  return true;
+}
+
+// Offers to link a book that couldn't be found on Hardcover.app, or to unlink it when it is linked to the wrong book
+QDialog *CLI::promptLink(QString contentId, QString query, QString message) {
+  ConfirmationDialog *dialog = ConfirmationDialogFactory__getConfirmationDialog(nullptr);
+  ConfirmationDialog__setAcceptButtonText(
+      dialog, Settings::getInstance()->getLinkedId(contentId).isEmpty() ? "Link book" : "Unlink book");
+  ConfirmationDialog__setRejectButtonText(dialog, "Cancel");
+  ConfirmationDialog__setTitle(dialog, "Hardcover.app");
+  ConfirmationDialog__setText(dialog, message);
+
+  QObject::connect(dialog, &QDialog::accepted, dialog, [contentId, query] {
+    nh_log("CLI::promptLink() accepted");
+
+    if (Settings::getInstance()->getLinkedId(contentId).isEmpty()) {
+      SearchDialog::show(contentId, query);
+    } else {
+      Settings::getInstance()->setLinkedId(contentId, QString());
+    }
+  });
+
+  dialog->open();
+  return dialog;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <QDialog>
+#include <QJsonArray>
 #include <QJsonObject>
 #include <QLabel>
 #include <QObject>
@@ -13,14 +15,25 @@ public:
     Network,
     Error,
     BookNotFound,
+    Timeout,
+  };
+
+  enum Priority {
+    Interactive,
+    Background,
   };
 
   struct Options {
     bool silent = false;
     bool icon = false;
+    Priority priority = Priority::Interactive;
+
+    // The request is cancelled once every owner is gone
+    QObject *owner = nullptr;
 
     QString contentId = QString();
     QString query = QString();
+    QString idempotencyKey = QString();
 
     Options() {};
 
@@ -29,6 +42,7 @@ public:
   };
 
   static CLI *listBookmarks(Options options = Options());
+  static CLI *listContent(Options options = Options());
   static CLI *listEditions(QString bookId, int readingFormat, QString language, Options options = Options());
   static CLI *listJournal(int limit, int offset, Options options = Options());
   static CLI *insertJournal(QString text, int percentage, QString privacy, Options options = Options());
@@ -39,29 +53,53 @@ public:
   static CLI *setUserBook(float rating, QString text, bool spoilers, bool sponsored, Options options = Options());
   static CLI *search(QString query, int limit, int page, Options options = Options());
   static CLI *update(int percentage, Options options = Options());
+  static CLI *updateBatch(QJsonArray books, Options options = Options());
+  static CLI *replay(QStringList arguments, Options options = Options());
+
+  static QDialog *promptLink(QString contentId, QString query, QString message);
+
+  void detach(QObject *owner);
 
 public Q_SLOTS:
   void networkConnected();
   void connectingFailed();
-  void processFinished(int exitCode);
-  void linkBook();
+  void received(QJsonObject doc);
+  void finished(int exitCode, QString error);
+  void timedOut();
+  void interrupted();
+  void ownerDestroyed(QObject *owner);
 
 Q_SIGNALS:
   void response(QJsonObject doc);
   void success();
   void failure(FailureReason reason);
+  void partial(QJsonObject doc);
 
 private:
   static QStringList getIdentifier(Options options);
+  static CLI *start(QStringList arguments, Options options);
 
   CLI(QStringList arguments, Options options = Options(), QObject *parent = nullptr);
 
   ~CLI();
 
   void showIcon(const char *path);
+  void attach(QObject *owner);
+  void promote(Options options);
+  void cancel();
+  void release();
+  bool keep();
 
   QLabel *icon = nullptr;
-  QTimer *timer = nullptr;
   QStringList arguments;
+  QString key;
   Options options;
+  int id = 0;
+  bool done = false;
+
+  QList<QObject *> owners;
+  int unowned = 0;
+
+  QJsonObject result;
+  bool hasResult = false;
 };
@@ -0,0 +1,483 @@
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <NickelHook.h>
+
+#include "cli.h"
+#include "cliprocess.h"
+#include "files.h"
+#include "settings.h"
+#include "wifisession.h"
+
+// How long the co-process is kept around after the last response
+static const int IDLE_TIMEOUT = 60000;
+
+// How long a terminated co-process gets to exit before it is killed
+static const int KILL_TIMEOUT = 5000;
+
+// Frame headers are a kind, a request id and a length, anything longer is garbage
+static const int MAX_HEADER_SIZE = 64;
+
+// Initial capacity of the stdout buffer, enough to hold most results without growing
+static const int BUFFER_SIZE = 64 * 1024;
+
+CLIProcess *CLIProcess::instance = nullptr;
+
+CLIProcess *CLIProcess::getInstance() {
+  if (instance == nullptr) {
+    instance = new CLIProcess();
+  };
+
+  return instance;
+};
+
+CLIProcess::CLIProcess(QObject *parent) : QObject(parent) {
+  idleTimer = new QTimer(this);
+  idleTimer->setSingleShot(true);
+  idleTimer->setInterval(IDLE_TIMEOUT);
+  connect(idleTimer, &QTimer::timeout, this, &CLIProcess::idle);
+};
+
+int CLIProcess::send(QStringList arguments, CLI *cli, CLI::Priority priority, int timeout, QString idempotencyKey) {
+  int id = ++nextId;
+  pending.insert(id, cli);
+  idleTimer->stop();
+
+  QJsonObject request;
+  request.insert("id", id);
+  request.insert("args", QJsonArray::fromStringList(arguments));
+
+  if (!idempotencyKey.isEmpty()) {
+    request.insert("idempotency_key", idempotencyKey);
+    keys.insert(id, idempotencyKey);
+  }
+
+  (priority == CLI::Priority::Interactive ? interactive : background)
+      .enqueue({id, arguments.first(), timeout, QJsonDocument(request).toJson(QJsonDocument::Compact).append('\n')});
+
+  schedule();
+
+  return id;
+}
+
+void CLIProcess::cancel(int id) {
+  // Queued requests are dropped by schedule() once they are no longer pending
+  pending.remove(id);
+
+  Channel *channel = owner(id);
+  if (channel == nullptr) {
+    // Never sent, so it can't have been applied
+    settle(id);
+    return;
+  }
+
+  if (cancelled.contains(id))
+    return;
+
+  nh_log("CLIProcess::cancel(%d)", id);
+
+  cancelled.insert(id);
+
+  QJsonObject request;
+  request.insert("id", id);
+  request.insert("cancel", true);
+  channel->process->write(QJsonDocument(request).toJson(QJsonDocument::Compact).append('\n'));
+
+  // Yield so a dialog closing several requests at once cancels all of them first
+  QTimer::singleShot(0, this, &CLIProcess::abandon);
+}
+
+void CLIProcess::abandon() {
+  // The retired co-process is never handed more work, so it only has to wait for requests that are still wanted
+  if (retired.process != nullptr && !retired.inflight.isEmpty() && (retired.inflight - cancelled).isEmpty()) {
+    terminate(retired.process);
+  }
+
+  if (current.process == nullptr || current.inflight.isEmpty() || !interactive.isEmpty() || !background.isEmpty())
+    return;
+
+  if (!(current.inflight - cancelled).isEmpty())
+    return;
+
+  // Nothing left is wanted, don't wait for the co-process to notice the cancellation between network requests
+  nh_log("CLIProcess::abandon()");
+  terminate(current.process);
+}
+
+void CLIProcess::expire(int id) {
+  QPointer<CLI> cli = pending.value(id);
+  Watchdog watchdog = watchdogs.value(id);
+
+  nh_log("%s request %d timed out after %lld ms", qPrintable(watchdog.name), id, watchdog.clock.elapsed());
+
+  // The request may be stuck anywhere, everything else goes to a fresh co-process while this one drains
+  bool stuck = current.inflight.contains(id);
+  cancel(id);
+  if (stuck) {
+    retire();
+  }
+  abandon();
+
+  if (cli) {
+    cli->timedOut();
+  }
+}
+
+void CLIProcess::terminate(QProcess *target) {
+  nh_log("CLIProcess::terminate()");
+
+  QPointer<QProcess> process = target;
+  process->terminate();
+
+  QTimer::singleShot(KILL_TIMEOUT, this, [process] {
+    if (process && process->state() != QProcess::NotRunning) {
+      nh_log("Killing unresponsive co-process");
+      process->kill();
+    }
+  });
+}
+
+// Moves a request still waiting for a slot to the interactive queue, one already handed out is left as is
+void CLIProcess::promote(int id) {
+  for (int i = 0; i < background.size(); i++) {
+    if (background.at(i).id == id) {
+      nh_log("CLIProcess::promote(%d)", id);
+      interactive.enqueue(background.takeAt(i));
+      schedule();
+      return;
+    }
+  }
+}
+
+bool CLIProcess::isRunning(QString idempotencyKey) { return keys.values().contains(idempotencyKey); }
+
+// The request can no longer change anything, whether or not it went through
+void CLIProcess::settle(int id) {
+  QString key = keys.take(id);
+  if (!key.isEmpty()) {
+    released(key);
+  }
+}
+
+qint64 CLIProcess::release(int id) {
+  Watchdog watchdog = watchdogs.take(id);
+  if (watchdog.timer == nullptr)
+    return 0;
+
+  watchdog.timer->stop();
+  watchdog.timer->deleteLater();
+  return watchdog.clock.elapsed();
+}
+
+CLIProcess::Channel *CLIProcess::find(QProcess *source) {
+  if (source == nullptr)
+    return nullptr;
+
+  if (source == current.process)
+    return &current;
+
+  if (source == retired.process)
+    return &retired;
+
+  return nullptr;
+}
+
+CLIProcess::Channel *CLIProcess::owner(int id) {
+  if (current.inflight.contains(id))
+    return &current;
+
+  if (retired.inflight.contains(id))
+    return &retired;
+
+  return nullptr;
+}
+
+void CLIProcess::schedule() {
+  int max = Settings::getInstance()->getMaxRequests();
+
+  while (!interactive.isEmpty() || !background.isEmpty()) {
+    bool isInteractive = !interactive.isEmpty();
+
+    // Keep a slot free so interactive requests never wait behind background work, requests left to a retired
+    // co-process don't take up a slot
+    int limit = isInteractive || max == 1 ? max : max - 1;
+    if (current.inflight.size() >= limit)
+      break;
+
+    Request request = isInteractive ? interactive.dequeue() : background.dequeue();
+    if (pending.value(request.id).isNull()) {
+      pending.remove(request.id);
+      settle(request.id);
+      continue;
+    }
+
+    if (current.process == nullptr) {
+      start();
+
+      // Failing to start can be reported before start() returns, the rest stays queued for the next request
+      if (current.process == nullptr) {
+        settle(request.id);
+        QPointer<CLI> cli = pending.take(request.id);
+        if (cli) {
+          cli->finished(1, "Failed to start the command line.");
+        }
+        break;
+      }
+    }
+
+    current.inflight.insert(request.id);
+    current.process->write(request.line);
+
+    Watchdog watchdog = {request.name, QElapsedTimer(), new QTimer(this)};
+    watchdog.clock.start();
+    watchdog.timer->setSingleShot(true);
+    connect(watchdog.timer, &QTimer::timeout, this, [this, id = request.id] { expire(id); });
+    watchdog.timer->start(request.timeout);
+    watchdogs.insert(request.id, watchdog);
+  }
+}
+
+void CLIProcess::start() {
+  nh_log("CLIProcess::start()");
+
+  current.buffer.resize(0);
+  current.buffer.reserve(BUFFER_SIZE);
+
+  QProcess *process = new QProcess(this);
+  current.process = process;
+
+  QObject::connect(process, &QProcess::readyReadStandardOutput, this, [this, process] { readyRead(process); });
+  QObject::connect(process, &QProcess::errorOccurred, this,
+                   [this, process](QProcess::ProcessError error) { processError(process, error); });
+  QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+                   [this, process](int exitCode) { processFinished(process, exitCode); });
+  starting = true;
+  process->start(Files::cli, {"serve", "--applied", Files::applied});
+  starting = false;
+}
+
+// New requests start a fresh co-process straight away, the current one exits on its own once stdin is closed and every
+// request it was handed has been answered
+void CLIProcess::retire() {
+  if (current.process == nullptr)
+    return;
+
+  nh_log("CLIProcess::retire()");
+
+  // Only one co-process is left to drain, one replaced again already had its chance
+  if (retired.process != nullptr) {
+    QProcess *process = retired.process;
+    QSet<int> ids = retired.inflight;
+    QList<QPointer<CLI>> lost = forget(retired);
+
+    QObject::disconnect(process, nullptr, this, nullptr);
+    QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), process,
+                     &QObject::deleteLater);
+
+    // Its requests may still go through until it is gone
+    QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this, ids] {
+      for (int id : ids) {
+        settle(id);
+      }
+    });
+    terminate(process);
+
+    for (QPointer<CLI> cli : lost) {
+      if (cli) {
+        cli->interrupted();
+      }
+    }
+  }
+
+  retired = current;
+  current = Channel();
+  retired.process->closeWriteChannel();
+
+  schedule();
+}
+
+void CLIProcess::reload() {
+  nh_log("CLIProcess::reload()");
+  retire();
+}
+
+void CLIProcess::idle() {
+  if (pending.isEmpty()) {
+    retire();
+  }
+}
+
+void CLIProcess::readyRead(QProcess *source) {
+  // Handlers may spin a nested event loop, the outer call picks up whatever arrives meanwhile
+  Channel *channel = find(source);
+  if (channel == nullptr || channel->reading)
+    return;
+
+  channel->reading = true;
+  bool malformed = false;
+
+  while (source->bytesAvailable() > 0) {
+    // Read straight into the reserved buffer
+    int size = channel->buffer.size();
+    qint64 available = source->bytesAvailable();
+    channel->buffer.resize(size + available);
+    channel->buffer.resize(size + qMax(source->read(channel->buffer.data() + size, available), qint64(0)));
+
+    // Only the short header is searched, the payload is skipped over using its length
+    int start = 0;
+    while (start < channel->buffer.size()) {
+      const QByteArray &buffer = channel->buffer;
+      int end = buffer.indexOf('\n', start);
+      if (end < 0) {
+        if (buffer.size() - start > MAX_HEADER_SIZE) {
+          malformed = true;
+        }
+        break;
+      }
+
+      QList<QByteArray> header = buffer.mid(start, end - start).split(' ');
+      bool ok = header.size() == 3 && header[0].size() == 1;
+      int id = ok ? header[1].toInt(&ok) : 0;
+      int length = ok ? header[2].toInt(&ok) : 0;
+
+      if (!ok || length < 0) {
+        malformed = true;
+        break;
+      }
+
+      if (end + 1 + length > buffer.size())
+        break;
+
+      dispatch(header[0][0], id, QByteArray::fromRawData(buffer.constData() + end + 1, length));
+      start = end + 1 + length;
+
+      // The co-process may have been retired while dispatching, which moves its buffer, or have gone away altogether
+      channel = find(source);
+      if (channel == nullptr)
+        return;
+    }
+
+    channel->buffer.remove(0, start);
+
+    if (malformed)
+      break;
+  }
+
+  channel->reading = false;
+
+  if (malformed) {
+    // Framing is lost so nothing else from this co-process can be trusted
+    nh_log("Malformed frame from the command line");
+    channel->buffer.resize(0);
+    terminate(source);
+    return;
+  }
+
+  if (pending.isEmpty()) {
+    idleTimer->start();
+    WifiSession::getInstance()->idle();
+  }
+}
+
+void CLIProcess::dispatch(char kind, int id, QByteArray payload) {
+  if (kind == 'L') {
+    nh_log("%.*s", payload.size(), payload.constData());
+    return;
+  }
+
+  QPointer<CLI> cli = pending.value(id);
+  QJsonObject doc = QJsonDocument::fromJson(payload).object();
+
+  if (kind == 'P') {
+    if (cli) {
+      cli->partial(doc);
+    }
+  } else if (kind == 'R') {
+    if (cli) {
+      cli->received(doc);
+    }
+  } else if (kind == 'E') {
+    nh_log("Request %d finished in %lld ms", id, release(id));
+    WifiSession::getInstance()->record(doc.value("requests").toInt(), doc.value("bytes").toDouble());
+
+    pending.remove(id);
+    current.inflight.remove(id);
+    retired.inflight.remove(id);
+    cancelled.remove(id);
+    settle(id);
+    schedule();
+
+    if (!cancelled.isEmpty()) {
+      abandon();
+    }
+
+    if (cli) {
+      cli->finished(doc.value("exit_code").toInt(), doc.value("stderr").toString());
+    }
+  }
+}
+
+void CLIProcess::processError(QProcess *source, QProcess::ProcessError error) {
+  if (error == QProcess::FailedToStart) {
+    nh_log("Failed to start %s", Files::cli);
+    processFinished(source, 1);
+  }
+}
+
+void CLIProcess::processFinished(QProcess *source, int exitCode) {
+  Channel *channel = find(source);
+  if (channel == nullptr)
+    return;
+
+  nh_log("CLIProcess::processFinished(%d)", exitCode);
+
+  QByteArray stderr = source->readAllStandardError();
+  if (!stderr.isEmpty()) {
+    nh_log("%s", stderr.constData());
+  }
+
+  if (channel == &current) {
+    idleTimer->stop();
+  }
+
+  source->deleteLater();
+  discard(*channel, stderr.isEmpty() ? "The command line exited unexpectedly." : QString(stderr));
+
+  // Starting again from inside start() would only fail the same way
+  if (!starting) {
+    schedule();
+  }
+
+  if (pending.isEmpty()) {
+    WifiSession::getInstance()->idle();
+  }
+}
+
+// Forgets the co-process, the requests still waiting on it are returned to be failed
+QList<QPointer<CLI>> CLIProcess::forget(Channel &channel) {
+  QList<QPointer<CLI>> lost;
+  for (int id : channel.inflight) {
+    release(id);
+    cancelled.remove(id);
+    lost.append(pending.take(id));
+  }
+
+  channel = Channel();
+  return lost;
+}
+
+// Forgets a co-process that is gone and fails every request still waiting on it
+void CLIProcess::discard(Channel &channel, QString error) {
+  for (int id : channel.inflight) {
+    settle(id);
+  }
+
+  QList<QPointer<CLI>> lost = forget(channel);
+
+  for (QPointer<CLI> cli : lost) {
+    if (cli) {
+      cli->finished(1, error);
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QProcess>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
+
+#include "cli.h"
+
+class CLIProcess : public QObject {
+  Q_OBJECT
+
+public:
+  static CLIProcess *getInstance();
+
+  int send(QStringList arguments, CLI *cli, CLI::Priority priority, int timeout, QString idempotencyKey);
+  void cancel(int id);
+  void promote(int id);
+  void reload();
+  bool isRunning(QString idempotencyKey);
+
+public Q_SLOTS:
+  void idle();
+  void abandon();
+  void expire(int id);
+
+Q_SIGNALS:
+  void released(QString idempotencyKey);
+
+private:
+  struct Request {
+    int id;
+    QString name;
+    int timeout;
+    QByteArray line;
+  };
+
+  struct Watchdog {
+    QString name;
+    QElapsedTimer clock;
+    QTimer *timer = nullptr;
+  };
+
+  // A co-process with the requests it was handed and whatever it wrote that isn't a whole frame yet
+  struct Channel {
+    QProcess *process = nullptr;
+    QByteArray buffer;
+    QSet<int> inflight;
+    bool reading = false;
+  };
+
+  CLIProcess(QObject *parent = nullptr);
+
+  static CLIProcess *instance;
+
+  void start();
+  void retire();
+  void schedule();
+  void readyRead(QProcess *source);
+  void dispatch(char kind, int id, QByteArray payload);
+  void processError(QProcess *source, QProcess::ProcessError error);
+  void processFinished(QProcess *source, int exitCode);
+  QList<QPointer<CLI>> forget(Channel &channel);
+  void discard(Channel &channel, QString error);
+  void terminate(QProcess *target);
+  Channel *find(QProcess *source);
+  Channel *owner(int id);
+  qint64 release(int id);
+  void settle(int id);
+
+  // New requests go to the current co-process, the retired one only finishes what it was handed before it was replaced
+  Channel current;
+  Channel retired;
+
+  QTimer *idleTimer = nullptr;
+  bool starting = false;
+
+  QQueue<Request> interactive;
+  QQueue<Request> background;
+  QSet<int> cancelled;
+  QHash<int, Watchdog> watchdogs;
+  QHash<int, QPointer<CLI>> pending;
+
+  // Idempotency keys of requests that are queued or may still be running, even after they timed out
+  QHash<int, QString> keys;
+  int nextId = 0;
+};
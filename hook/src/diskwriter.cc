@@ -0,0 +1,160 @@
+#include <QFile>
+#include <QSaveFile>
+#include <QSettings>
+
+#include <NickelHook.h>
+
+#include "diskwriter.h"
+
+// Milliseconds to wait for more changes before writing
+static const int COALESCE_WINDOW = 2000;
+
+bool DiskWorker::writeFile(QString path, QByteArray bytes, bool replace) {
+  if (replace) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+      nh_log("Failed to open %s", qPrintable(path));
+      return false;
+    }
+
+    file.write(bytes);
+    return file.commit();
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+    nh_log("Failed to open %s", qPrintable(path));
+    return false;
+  }
+
+  return file.write(bytes) == bytes.size();
+}
+
+bool DiskWorker::writeSettings(QString path, QVariantHash values) {
+  QSettings settings(path, QSettings::IniFormat);
+
+  QVariantHash::const_iterator i = values.constBegin();
+  while (i != values.constEnd()) {
+    if (i.value().isNull()) {
+      settings.remove(i.key());
+    } else {
+      settings.setValue(i.key(), i.value());
+    }
+    ++i;
+  }
+
+  settings.sync();
+  return settings.status() == QSettings::NoError;
+}
+
+bool DiskWorker::renameFile(QString path, QString newPath) {
+  QFile::remove(newPath);
+  return QFile::rename(path, newPath);
+}
+
+void DiskWorker::readSettings(QString path) {
+  QSettings settings(path, QSettings::IniFormat);
+  QVariantHash values;
+
+  foreach (const QString &key, settings.allKeys()) {
+    values.insert(key, settings.value(key));
+  }
+
+  settingsRead(path, values);
+}
+
+DiskWriter *DiskWriter::instance = nullptr;
+
+DiskWriter *DiskWriter::getInstance() {
+  if (instance == nullptr) {
+    instance = new DiskWriter();
+  };
+
+  return instance;
+};
+
+DiskWriter::DiskWriter(QObject *parent) : QObject(parent) {
+  worker->moveToThread(thread);
+  QObject::connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+  QObject::connect(worker, &DiskWorker::settingsRead, this, &DiskWriter::settingsRead);
+  thread->start(QThread::LowPriority);
+
+  timer->setSingleShot(true);
+  QObject::connect(timer, &QTimer::timeout, this, [this] { flush(); });
+};
+
+void DiskWriter::append(QString path, QByteArray bytes) {
+  files[path].bytes.append(bytes);
+  schedule();
+}
+
+// Whatever was appended before is part of the new contents
+void DiskWriter::replace(QString path, QByteArray bytes) {
+  Pending &pending = files[path];
+  pending.bytes = bytes;
+  pending.replace = true;
+  schedule();
+}
+
+void DiskWriter::setValue(QString path, QString key, QVariant value) {
+  settings[path].insert(key, value);
+  schedule();
+}
+
+// Runs after every write handed over so far, so it sees them
+void DiskWriter::read(QString path) {
+  flush();
+  QMetaObject::invokeMethod(worker, "readSettings", Qt::QueuedConnection, Q_ARG(QString, path));
+}
+
+// Writes made to the path before this end up in the renamed file, the ones after in a new one
+void DiskWriter::rename(QString path, QString newPath) {
+  flush();
+  QMetaObject::invokeMethod(worker, "renameFile", Qt::QueuedConnection, Q_ARG(QString, path), Q_ARG(QString, newPath));
+}
+
+void DiskWriter::schedule() {
+  if (!timer->isActive()) {
+    timer->start(COALESCE_WINDOW);
+  }
+}
+
+// Waiting blocks until everything is on disk, only for when that matters more than the GUI, such as before sleeping
+bool DiskWriter::flush(bool wait) {
+  timer->stop();
+
+  Qt::ConnectionType type = wait ? Qt::BlockingQueuedConnection : Qt::QueuedConnection;
+  bool ok = true;
+
+  QHash<QString, Pending>::const_iterator i = files.constBegin();
+  while (i != files.constEnd()) {
+    bool written = true;
+    if (wait) {
+      QMetaObject::invokeMethod(worker, "writeFile", type, Q_RETURN_ARG(bool, written), Q_ARG(QString, i.key()),
+                                Q_ARG(QByteArray, i->bytes), Q_ARG(bool, i->replace));
+    } else {
+      QMetaObject::invokeMethod(worker, "writeFile", type, Q_ARG(QString, i.key()), Q_ARG(QByteArray, i->bytes),
+                                Q_ARG(bool, i->replace));
+    }
+    ok = ok && written;
+    ++i;
+  }
+
+  QHash<QString, QVariantHash>::const_iterator j = settings.constBegin();
+  while (j != settings.constEnd()) {
+    bool written = true;
+    if (wait) {
+      QMetaObject::invokeMethod(worker, "writeSettings", type, Q_RETURN_ARG(bool, written), Q_ARG(QString, j.key()),
+                                Q_ARG(QVariantHash, j.value()));
+    } else {
+      QMetaObject::invokeMethod(worker, "writeSettings", type, Q_ARG(QString, j.key()), Q_ARG(QVariantHash, j.value()));
+    }
+    ok = ok && written;
+    ++j;
+  }
+
+  files.clear();
+  settings.clear();
+
+  return ok;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QVariant>
+
+// Lives on the writer thread and does the actual file IO
+class DiskWorker : public QObject {
+  Q_OBJECT
+
+public Q_SLOTS:
+  bool writeFile(QString path, QByteArray bytes, bool replace);
+  bool writeSettings(QString path, QVariantHash values);
+  bool renameFile(QString path, QString newPath);
+  void readSettings(QString path);
+
+Q_SIGNALS:
+  void settingsRead(QString path, QVariantHash values);
+};
+
+// Collects writes made on the GUI thread and hands them to a worker thread a short while later, so several changes cost
+// one write and nothing waits on the flash
+class DiskWriter : public QObject {
+  Q_OBJECT
+
+public:
+  static DiskWriter *getInstance();
+
+  void append(QString path, QByteArray bytes);
+  void replace(QString path, QByteArray bytes);
+  void setValue(QString path, QString key, QVariant value);
+  void read(QString path);
+  void rename(QString path, QString newPath);
+
+  bool flush(bool wait = false);
+
+Q_SIGNALS:
+  void settingsRead(QString path, QVariantHash values);
+
+private:
+  struct Pending {
+    QByteArray bytes;
+    bool replace = false;
+  };
+
+  DiskWriter(QObject *parent = nullptr);
+
+  static DiskWriter *instance;
+
+  void schedule();
+
+  QThread *thread = new QThread(this);
+  DiskWorker *worker = new DiskWorker();
+  QTimer *timer = new QTimer(this);
+
+  QHash<QString, Pending> files;
+  QHash<QString, QVariantHash> settings;
+};
@@ -85,7 +85,15 @@ void EditionsDialog::request() {
   editionsInitialized = false;
   pages->clear();
 
-  CLI *cli = CLI::listEditions(bookId, readingFormat.toInt(), lang);
+  // The filters changed, the previous listing is no longer wanted
+  if (cli) {
+    cli->detach(this);
+  }
+
+  CLI::Options options;
+  options.owner = this;
+
+  cli = CLI::listEditions(bookId, readingFormat.toInt(), lang, options);
   QObject::connect(cli, &CLI::response, this, &EditionsDialog::response);
 }
 
@@ -1,5 +1,7 @@
 #include <QJsonArray>
+#include <QPointer>
 
+#include "../cli.h"
 #include "../nickelhardcover.h"
 #include "../widgets/dialog.h"
 #include "../widgets/pagedstack.h"
@@ -28,6 +30,7 @@ private:
 
   N3ButtonLabel *langButton = nullptr;
   PagedStack *pages = nullptr;
+  QPointer<CLI> cli;
 
   QString bookId = 0;
   QVariant readingFormat = 4;
@@ -3,9 +3,15 @@
 namespace Files {
 constexpr char const *config = "/mnt/onboard/.adds/NickelHardcover/config.ini";
 constexpr char const *settings = "/mnt/onboard/.adds/NickelHardcover/settings.ini";
+constexpr char const *books = "/mnt/onboard/.adds/NickelHardcover/books.log";
 constexpr char const *koboSettings = "/mnt/onboard/.kobo/Kobo/Kobo eReader.conf";
 constexpr char const *cli = "/mnt/onboard/.adds/NickelHardcover/CLI";
 constexpr char const *adds_directory = "/mnt/onboard/.adds/NickelHardcover";
+constexpr char const *outbox = "/mnt/onboard/.adds/NickelHardcover/outbox.jsonl";
+constexpr char const *applied = "/mnt/onboard/.adds/NickelHardcover/applied";
+constexpr char const *queue = "/mnt/onboard/.adds/NickelHardcover/queue.log";
+constexpr char const *sessions = "/mnt/onboard/.adds/NickelHardcover/sessions.csv";
+constexpr char const *sessionsOld = "/mnt/onboard/.adds/NickelHardcover/sessions.old.csv";
 
 constexpr char const *arrow_backward = ":/images/reading/global_backward.png";
 constexpr char const *arrow_down = ":/images/widgets/settings_date_time_down.png";
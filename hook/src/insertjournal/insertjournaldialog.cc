@@ -21,6 +21,7 @@ InsertJournalDialog::InsertJournalDialog() : Dialog("Add New Journal Entry") {
   if (journalPrivacy == "account") {
     CLI::Options options;
     options.silent = true;
+    options.owner = this;
 
     CLI *cli = CLI::getUser(options);
     QObject::connect(cli, &CLI::response, this, &InsertJournalDialog::setPrivacy);
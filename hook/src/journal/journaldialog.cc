@@ -75,7 +75,10 @@ void JournalDialog::newEntry() {
 void JournalDialog::requestPage(int index) {
   nh_log("JournalDialog::requestPage(%d)", index);
 
-  CLI *cli = CLI::listJournal(15, offset);
+  CLI::Options options;
+  options.owner = this;
+
+  CLI *cli = CLI::listJournal(15, offset, options);
   QObject::connect(cli, &CLI::response, this, &JournalDialog::response);
 }
 
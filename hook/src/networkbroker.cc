@@ -0,0 +1,89 @@
+#include <NickelHook.h>
+
+#include "networkbroker.h"
+#include "nickelhardcover.h"
+#include "wifisession.h"
+
+// How long to wait for Wi-Fi before giving up on every waiting request
+static const int CONNECT_TIMEOUT = 30000;
+
+NetworkBroker *NetworkBroker::instance = nullptr;
+
+NetworkBroker *NetworkBroker::getInstance() {
+  if (instance == nullptr) {
+    instance = new NetworkBroker();
+  };
+
+  return instance;
+};
+
+NetworkBroker::NetworkBroker(QObject *parent) : QObject(parent) {
+  timer = new QTimer(this);
+  timer->setSingleShot(true);
+  timer->setInterval(CONNECT_TIMEOUT);
+  connect(timer, &QTimer::timeout, this, &NetworkBroker::connectingFailed);
+
+  WirelessManager *wm = WirelessManager__sharedInstance();
+  QObject::connect(wm, SIGNAL(networkConnected()), this, SLOT(networkConnected()));
+
+  WirelessWorkflowManager *wfm = WirelessWorkflowManager__sharedInstance();
+  QObject::connect(wfm, SIGNAL(connectingFailed()), this, SLOT(connectingFailed()));
+};
+
+bool NetworkBroker::isAvailable() {
+  return WirelessWorkflowManager__isInternetAccessible(WirelessWorkflowManager__sharedInstance());
+}
+
+void NetworkBroker::request(bool silent) {
+  // Only one attempt at a time, a request that isn't silent upgrades a silent attempt so the user sees the prompt
+  if (connecting && (silent || interactive))
+    return;
+
+  nh_log("NetworkBroker::request(%s)", silent ? "silent" : "interactive");
+
+  connecting = true;
+  interactive = interactive || !silent;
+  timer->start();
+
+  // Yield to the caller so signals can be setup before a possible connectingFailed() is triggered
+  QTimer::singleShot(0, this, [silent] {
+    WirelessWorkflowManager *wfm = WirelessWorkflowManager__sharedInstance();
+
+    if (silent) {
+      WirelessWorkflowManager__connectWirelessSilently(wfm);
+    } else {
+      WirelessWorkflowManager__connectWireless(wfm, false, false);
+    }
+  });
+}
+
+void NetworkBroker::networkConnected() {
+  nh_log("NetworkBroker::networkConnected()");
+
+  WifiSession::getInstance()->begin();
+
+  timer->stop();
+  connecting = false;
+  interactive = false;
+
+  ready();
+}
+
+void NetworkBroker::connectingFailed() {
+  if (!connecting)
+    return;
+
+  nh_log("NetworkBroker::connectingFailed()");
+
+  timer->stop();
+  connecting = false;
+
+  // One dialog for everyone that was waiting
+  if (interactive) {
+    ConfirmationDialogFactory__showErrorDialog("Hardcover.app", "Failed to connect to WIFI.");
+  }
+
+  interactive = false;
+
+  failed();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+
+class NetworkBroker : public QObject {
+  Q_OBJECT
+
+public:
+  static NetworkBroker *getInstance();
+
+  bool isAvailable();
+  void request(bool silent);
+
+public Q_SLOTS:
+  void networkConnected();
+  void connectingFailed();
+
+Q_SIGNALS:
+  void ready();
+  void failed();
+
+private:
+  NetworkBroker(QObject *parent = nullptr);
+
+  static NetworkBroker *instance;
+
+  QTimer *timer = nullptr;
+  bool connecting = false;
+  bool interactive = false;
+};
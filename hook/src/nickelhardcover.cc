@@ -3,6 +3,7 @@
 #include <QJsonObject>
 #include <QStackedWidget>
 #include <QString>
+#include <QTimer>
 
 #include <NickelHook.h>
 
@@ -241,17 +242,31 @@ static struct nh_dlsym NickelHardcoverDlsym[] = {
 };
 // clang-format on
 
+// Sets up the sync queue so retries that came due while the Kobo was off go out without waiting for a book to be opened
+int hardcover_init() {
+  // Nickel is still starting up, wait until its event loop runs
+  QTimer::singleShot(0, [] { SyncController::getInstance(); });
+
+  return 0;
+}
+
 bool hardcover_uninstall() {
   nh_delete_file(Files::config);
   nh_delete_file(Files::settings);
+  nh_delete_file(Files::books);
   nh_delete_file(Files::cli);
+  nh_delete_file(Files::outbox);
+  nh_delete_file(Files::applied);
+  nh_delete_file(Files::queue);
+  nh_delete_file(Files::sessions);
+  nh_delete_file(Files::sessionsOld);
   nh_delete_dir(Files::adds_directory);
 
   return true;
 }
 
-NickelHook(.init = nullptr, .info = &NickelHardcover, .hook = NickelHardcoverHook, .dlsym = NickelHardcoverDlsym,
-           .uninstall = &hardcover_uninstall);
+NickelHook(.init = &hardcover_init, .info = &NickelHardcover, .hook = NickelHardcoverHook,
+           .dlsym = NickelHardcoverDlsym, .uninstall = &hardcover_uninstall);
 
 QStackedWidget *stackedWidget = nullptr;
 
@@ -0,0 +1,206 @@
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QTimer>
+
+#include <NickelHook.h>
+#include <unistd.h>
+
+#include "cliprocess.h"
+#include "files.h"
+#include "networkbroker.h"
+#include "outbox.h"
+#include "settings.h"
+#include "wifisession.h"
+
+Outbox *Outbox::instance = nullptr;
+
+Outbox *Outbox::getInstance() {
+  if (instance == nullptr) {
+    instance = new Outbox();
+  };
+
+  return instance;
+};
+
+Outbox::Outbox(QObject *parent) : QObject(parent) {
+  load();
+  QObject::connect(WifiSession::getInstance(), &WifiSession::flush, this, &Outbox::drain);
+  // Queued as requests are settled while CLIProcess is still going through its channels
+  QObject::connect(CLIProcess::getInstance(), &CLIProcess::released, this, &Outbox::drain, Qt::QueuedConnection);
+  QObject::connect(Settings::getInstance(), &Settings::bookChanged, this, &Outbox::relink);
+};
+
+static QByteArray serialize(QString idempotencyKey, QString contentId, QStringList arguments, bool unlinked) {
+  QJsonObject record;
+  record.insert("key", idempotencyKey);
+  record.insert("content_id", contentId);
+  record.insert("args", QJsonArray::fromStringList(arguments));
+
+  if (unlinked) {
+    record.insert("unlinked", true);
+  }
+
+  return QJsonDocument(record).toJson(QJsonDocument::Compact).append('\n');
+}
+
+void Outbox::load() {
+  QFile file(Files::outbox);
+  if (!file.open(QIODevice::ReadOnly))
+    return;
+
+  while (!file.atEnd()) {
+    QJsonObject record = QJsonDocument::fromJson(file.readLine()).object();
+
+    // A line cut short by a power loss
+    if (record.isEmpty())
+      continue;
+
+    QStringList arguments;
+    foreach (const QJsonValue &value, record.value("args").toArray()) {
+      arguments.append(value.toString());
+    }
+
+    records.append({record.value("key").toString(), record.value("content_id").toString(), arguments,
+                    record.value("unlinked").toBool()});
+  }
+
+  nh_log("Loaded %d records from the outbox", records.size());
+}
+
+void Outbox::append(QStringList arguments, QString idempotencyKey, QString contentId) {
+  // Replayed records end up here again when they fail
+  for (const Record &record : records) {
+    if (record.idempotencyKey == idempotencyKey)
+      return;
+  }
+
+  nh_log("Keeping %s %s in the outbox", qPrintable(arguments.first()), qPrintable(idempotencyKey));
+
+  records.append({idempotencyKey, contentId, arguments});
+
+  QFile file(Files::outbox);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+    nh_log("Failed to open %s", Files::outbox);
+    return;
+  }
+
+  file.write(serialize(idempotencyKey, contentId, arguments, false));
+  file.flush();
+  fsync(file.handle());
+
+  // Already online, no new connection is coming to send it. Yields so the request that failed is done first.
+  QTimer::singleShot(0, this, &Outbox::drain);
+}
+
+void Outbox::save() {
+  QSaveFile file(Files::outbox);
+  if (!file.open(QIODevice::WriteOnly)) {
+    nh_log("Failed to open %s", Files::outbox);
+    return;
+  }
+
+  for (const Record &record : records) {
+    file.write(serialize(record.idempotencyKey, record.contentId, record.arguments, record.unlinked));
+  }
+
+  file.commit();
+}
+
+void Outbox::drain() {
+  if (draining || records.isEmpty() || !NetworkBroker::getInstance()->isAvailable())
+    return;
+
+  nh_log("Draining %d records from the outbox", records.size());
+
+  draining = true;
+  next();
+}
+
+void Outbox::next() {
+  // Strictly in order for each book so a status change never overtakes the change it followed
+  QSet<QString> held;
+  for (replaying = 0; replaying < records.size(); replaying++) {
+    const Record &record = records.at(replaying);
+    if (record.unlinked || held.contains(record.contentId)) {
+      held.insert(record.contentId);
+      continue;
+    }
+
+    // It timed out, but the co-process it was handed to may still send it. Sending it again now could apply it twice.
+    if (CLIProcess::getInstance()->isRunning(record.idempotencyKey))
+      break;
+
+    replay(record);
+    return;
+  }
+
+  draining = false;
+}
+
+void Outbox::replay(Record record) {
+  CLI::Options options;
+  options.silent = true;
+  options.priority = CLI::Priority::Background;
+  options.contentId = record.contentId;
+  options.idempotencyKey = record.idempotencyKey;
+
+  CLI *cli = CLI::replay(record.arguments, options);
+  QObject::connect(cli, &CLI::success, this, &Outbox::success);
+  QObject::connect(cli, &CLI::failure, this, &Outbox::failure);
+}
+
+void Outbox::success() {
+  records.removeAt(replaying);
+  save();
+  next();
+}
+
+void Outbox::failure(CLI::FailureReason reason) {
+  if (reason == CLI::FailureReason::Network || reason == CLI::FailureReason::Timeout) {
+    // Try again with the next connection
+    draining = false;
+    return;
+  }
+
+  Record &record = records[replaying];
+
+  if (reason == CLI::FailureReason::BookNotFound) {
+    nh_log("Holding %s %s until the book is linked", qPrintable(record.arguments.first()),
+           qPrintable(record.idempotencyKey));
+
+    record.unlinked = true;
+    save();
+    next();
+    return;
+  }
+
+  // Sending it again would fail the same way and hold up everything behind it
+  nh_log("Dropping %s %s from the outbox", qPrintable(record.arguments.first()), qPrintable(record.idempotencyKey));
+
+  records.removeAt(replaying);
+  save();
+  next();
+}
+
+void Outbox::relink(QString contentId) {
+  if (Settings::getInstance()->getLinkedId(contentId).isEmpty())
+    return;
+
+  bool linked = false;
+  for (Record &record : records) {
+    if (record.unlinked && record.contentId == contentId) {
+      record.unlinked = false;
+      linked = true;
+    }
+  }
+
+  if (!linked)
+    return;
+
+  save();
+  drain();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QList>
+#include <QObject>
+#include <QStringList>
+
+#include "cli.h"
+
+class Outbox : public QObject {
+  Q_OBJECT
+
+public:
+  static Outbox *getInstance();
+
+  void append(QStringList arguments, QString idempotencyKey, QString contentId);
+
+public Q_SLOTS:
+  void drain();
+  void success();
+  void failure(CLI::FailureReason reason);
+  void relink(QString contentId);
+
+private:
+  struct Record {
+    QString idempotencyKey;
+    QString contentId;
+    QStringList arguments;
+
+    // The book couldn't be found, held back until it is linked
+    bool unlinked = false;
+  };
+
+  Outbox(QObject *parent = nullptr);
+
+  static Outbox *instance;
+
+  void load();
+  void save();
+  void next();
+  void replay(Record record);
+
+  QList<Record> records;
+  int replaying = 0;
+  bool draining = false;
+};
@@ -0,0 +1,199 @@
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+#include <NickelHook.h>
+
+#include "diskwriter.h"
+#include "recordlog.h"
+
+// Records are an op, then the key and the value each prefixed by their length as a little endian 16-bit integer.
+// Updates replace the key with its index, which is also 16-bit.
+static const char OP_PUT = 'P';
+static const char OP_UPDATE = 'U';
+static const char OP_REMOVE = 'R';
+
+static const int MAX_INDEXES = 0xffff;
+
+// Don't bother compacting small logs
+static const int MIN_COMPACT_RECORDS = 256;
+
+static void writeUpdate(QByteArray &bytes, int index, QByteArray value) {
+  int start = bytes.size();
+  bytes.resize(start + 1 + 2 + 2 + value.size());
+  uchar *out = reinterpret_cast<uchar *>(bytes.data() + start);
+
+  *out = OP_UPDATE;
+  qToLittleEndian<quint16>(index, out + 1);
+  qToLittleEndian<quint16>(value.size(), out + 3);
+  memcpy(out + 5, value.constData(), value.size());
+}
+
+static void writeRecord(QByteArray &bytes, char op, QByteArray key, QByteArray value) {
+  int start = bytes.size();
+  bytes.resize(start + 1 + 2 + key.size() + 2 + value.size());
+  char *out = bytes.data() + start;
+
+  *out++ = op;
+  qToLittleEndian<quint16>(key.size(), reinterpret_cast<uchar *>(out));
+  memcpy(out + 2, key.constData(), key.size());
+  out += 2 + key.size();
+  qToLittleEndian<quint16>(value.size(), reinterpret_cast<uchar *>(out));
+  memcpy(out + 2, value.constData(), value.size());
+}
+
+RecordLog::RecordLog(QString path) : path(path) {}
+
+const QHash<QByteArray, QByteArray> &RecordLog::entries() {
+  load();
+  return data;
+}
+
+QByteArray RecordLog::value(QByteArray key) {
+  load();
+  return data.value(key);
+}
+
+// Bytes the log takes up on disk once written
+qint64 RecordLog::size() {
+  load();
+  return bytes;
+}
+
+void RecordLog::load() {
+  if (loaded)
+    return;
+
+  loaded = true;
+
+  QFile in(path);
+  if (!in.open(QIODevice::ReadOnly))
+    return;
+
+  QByteArray contents = in.readAll();
+  const char *pos = contents.constData();
+  const char *end = pos + contents.size();
+
+  while (end - pos >= 5) {
+    char op = pos[0];
+
+    if (op == OP_UPDATE) {
+      int i = qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(pos + 1));
+      int valueSize = qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(pos + 3));
+      if (i >= keys.size() || end - pos < 5 + valueSize)
+        break;
+
+      data.insert(keys.at(i), QByteArray(pos + 5, valueSize));
+      pos += 5 + valueSize;
+      records++;
+      continue;
+    }
+
+    int keySize = qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(pos + 1));
+    if (end - pos < 3 + keySize + 2)
+      break;
+
+    const char *key = pos + 3;
+    int valueSize = qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(key + keySize));
+    const char *value = key + keySize + 2;
+    if (end - value < valueSize)
+      break;
+
+    if (op == OP_PUT) {
+      QByteArray k(key, keySize);
+      index(k);
+      data.insert(k, QByteArray(value, valueSize));
+    } else if (op == OP_REMOVE) {
+      data.remove(QByteArray(key, keySize));
+    } else {
+      break;
+    }
+
+    pos = value + valueSize;
+    records++;
+  }
+
+  bytes = pos - contents.constData();
+
+  // Anything left over is a record cut short by a power loss, drop it so new records don't end up behind it
+  if (pos != end) {
+    nh_log("Discarding %d trailing bytes from %s", int(end - pos), qPrintable(path));
+    compact();
+  }
+}
+
+void RecordLog::put(QByteArray key, QByteArray value) {
+  load();
+
+  QHash<QByteArray, QByteArray>::const_iterator i = data.constFind(key);
+  if (i != data.constEnd() && i.value() == value)
+    return;
+
+  data.insert(key, value);
+  append(OP_PUT, key, value);
+}
+
+void RecordLog::remove(QByteArray key) {
+  load();
+
+  if (data.remove(key) == 0)
+    return;
+
+  append(OP_REMOVE, key, QByteArray());
+}
+
+// Removed keys keep their index until the next compaction, in case they come back
+void RecordLog::index(QByteArray key) {
+  if (!indexes.contains(key) && keys.size() < MAX_INDEXES) {
+    indexes.insert(key, keys.size());
+    keys.append(key);
+  }
+}
+
+// Replace everything with a single write, for filling the log in bulk
+void RecordLog::reset(QHash<QByteArray, QByteArray> entries) {
+  loaded = true;
+  data = entries;
+  compact();
+}
+
+void RecordLog::append(char op, QByteArray key, QByteArray value) {
+  if (records >= MIN_COMPACT_RECORDS && records > data.size() * 2) {
+    compact();
+    return;
+  }
+
+  QByteArray record;
+  QHash<QByteArray, int>::const_iterator i = indexes.constFind(key);
+  if (op == OP_PUT && i != indexes.constEnd()) {
+    writeUpdate(record, i.value(), value);
+  } else {
+    writeRecord(record, op, key, value);
+    if (op == OP_PUT) {
+      index(key);
+    }
+  }
+
+  DiskWriter::getInstance()->append(path, record);
+  records++;
+  bytes += record.size();
+}
+
+void RecordLog::compact() {
+  load();
+
+  keys.clear();
+  indexes.clear();
+
+  QByteArray contents;
+  QHash<QByteArray, QByteArray>::const_iterator i = data.constBegin();
+  while (i != data.constEnd()) {
+    writeRecord(contents, OP_PUT, i.key(), i.value());
+    index(i.key());
+    ++i;
+  }
+
+  DiskWriter::getInstance()->replace(path, contents);
+  records = data.size();
+  bytes = contents.size();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+// Key/value store kept as an append-only log of changes, replayed into memory on load and rewritten once it is mostly
+// superseded records. Each change costs one small append instead of rewriting the whole file, written behind by
+// DiskWriter. Keys are only written out the first time, later changes refer to them by the order they first appeared.
+class RecordLog {
+public:
+  RecordLog(QString path);
+
+  const QHash<QByteArray, QByteArray> &entries();
+  QByteArray value(QByteArray key);
+  qint64 size();
+
+  void put(QByteArray key, QByteArray value);
+  void remove(QByteArray key);
+  void reset(QHash<QByteArray, QByteArray> entries);
+  void compact();
+
+private:
+  void load();
+  void append(char op, QByteArray key, QByteArray value);
+  void index(QByteArray key);
+
+  QString path;
+  QHash<QByteArray, QByteArray> data;
+  QList<QByteArray> keys;
+  QHash<QByteArray, int> indexes;
+  bool loaded = false;
+  int records = 0;
+  qint64 bytes = 0;
+};
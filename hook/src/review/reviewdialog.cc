@@ -56,7 +56,10 @@ ReviewDialog::ReviewDialog() : Dialog("Write your review") {
   loading->setAlignment(Qt::AlignCenter);
   layout->addWidget(loading, 1);
 
-  CLI *cli = CLI::getUserBook();
+  CLI::Options options;
+  options.owner = this;
+
+  CLI *cli = CLI::getUserBook(options);
   QObject::connect(cli, &CLI::response, this, &ReviewDialog::response);
   QObject::connect(cli, &CLI::failure, dialog, &QDialog::deleteLater);
 }
@@ -70,6 +70,11 @@ SearchDialog::SearchDialog(QString contentId, QString query) : Dialog("Manually
 void SearchDialog::commit() {
   QObject::disconnect(pages, &PagedStack::afterLayout, this, &SearchDialog::commit);
 
+  // Results for the previous query would only be thrown away
+  if (request) {
+    request->detach(this);
+  }
+
   pages->clear();
   pages->next();
 }
@@ -81,8 +86,11 @@ void SearchDialog::requestPage(int index) {
   int limit = pages->getAvailableHeight() / dummy->sizeHint().height();
   dummy->deleteLater();
 
-  CLI *cli = CLI::search(query, limit, index);
-  QObject::connect(cli, &CLI::response, this, &SearchDialog::response);
+  CLI::Options options;
+  options.owner = this;
+
+  request = CLI::search(query, limit, index, options);
+  QObject::connect(request, &CLI::response, this, &SearchDialog::response);
 }
 
 void SearchDialog::response(QJsonObject doc) {
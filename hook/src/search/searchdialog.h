@@ -1,6 +1,8 @@
+#include <QPointer>
 #include <QVBoxLayout>
 #include <QWidget>
 
+#include "../cli.h"
 #include "../nickelhardcover.h"
 #include "../widgets/dialog.h"
 #include "../widgets/pagedstack.h"
@@ -25,6 +27,7 @@ private:
   PagedStack *pages = nullptr;
   TouchLineEdit *lineEdit = nullptr;
   QString contentId;
+  QPointer<CLI> request;
 
   void clear();
 };
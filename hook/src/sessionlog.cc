@@ -0,0 +1,151 @@
+#include <QDateTime>
+#include <QFileInfo>
+
+#include <NickelHook.h>
+
+#include "diskwriter.h"
+#include "files.h"
+#include "sessionlog.h"
+
+// Longer pauses between page turns are a break rather than reading time
+static const qint64 MAX_GAP = 5 * 60 * 1000;
+
+// Summaries kept in memory for scheduling, older ones are only in the export
+static const int MAX_SESSIONS = 64;
+
+// The export is moved aside once it reaches this size, replacing the one moved aside before
+static const qint64 MAX_EXPORT_SIZE = 256 * 1024;
+
+static const char *EXPORT_HEADER = "content_id,start,end,start_progress,end_progress,pages,pages_per_minute\n";
+
+SessionLog *SessionLog::instance = nullptr;
+
+SessionLog *SessionLog::getInstance() {
+  if (instance == nullptr) {
+    instance = new SessionLog();
+  };
+
+  return instance;
+};
+
+SessionLog::SessionLog(QObject *parent) : QObject(parent) {};
+
+void SessionLog::begin(QString contentId, int progress) {
+  end();
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+  reading = true;
+  active = 0;
+  current.contentId = contentId;
+  current.start = now;
+  current.end = now;
+  current.startProgress = progress;
+  current.endProgress = progress;
+  current.pages = 0;
+
+  sample(now, contentId, progress);
+}
+
+void SessionLog::record(QString contentId, int progress, int pages) {
+  if (!reading || current.contentId != contentId) {
+    begin(contentId, progress);
+  }
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  const Sample &previous = samples[(head + SAMPLES - 1) % SAMPLES];
+
+  active += qMin(now - previous.timestamp, MAX_GAP);
+  current.end = now;
+  current.endProgress = progress;
+  current.pages += pages;
+
+  sample(now, contentId, progress);
+}
+
+void SessionLog::sample(qint64 timestamp, QString contentId, int progress) {
+  Sample &entry = samples[head];
+  entry.timestamp = timestamp;
+  entry.contentId = contentId;
+  entry.progress = progress;
+
+  head = (head + 1) % SAMPLES;
+}
+
+void SessionLog::end() {
+  if (!reading)
+    return;
+
+  reading = false;
+
+  // Opening a book and closing it again isn't reading
+  if (current.pages == 0)
+    return;
+
+  current.pagesPerMinute = active > 0 ? current.pages * 60000.0 / active : 0;
+
+  nh_log("Reading session of %s: %d pages from %d%% to %d%% at %.1f pages per minute", qPrintable(current.contentId),
+         current.pages, current.startProgress, current.endProgress, current.pagesPerMinute);
+
+  sessions.append(current);
+  if (sessions.size() > MAX_SESSIONS) {
+    sessions.removeFirst();
+  }
+
+  save(current);
+}
+
+const SessionLog::Session *SessionLog::last(QString contentId) {
+  for (int i = sessions.size() - 1; i >= 0; i--) {
+    if (sessions.at(i).contentId == contentId) {
+      return &sessions.at(i);
+    }
+  }
+
+  return nullptr;
+}
+
+// Milliseconds since epoch of the last page turn in the book, 0 if it wasn't read since Nickel started
+qint64 SessionLog::lastRead(QString contentId) {
+  if (reading && current.contentId == contentId)
+    return samples[(head + SAMPLES - 1) % SAMPLES].timestamp;
+
+  const Session *session = last(contentId);
+  return session == nullptr ? 0 : session->end;
+}
+
+void SessionLog::save(const Session &session) {
+  DiskWriter *writer = DiskWriter::getInstance();
+
+  if (exported < 0) {
+    exported = QFileInfo(Files::sessions).size();
+  }
+
+  if (exported >= MAX_EXPORT_SIZE) {
+    nh_log("Moving %s aside after %lld bytes", Files::sessions, exported);
+    writer->rename(Files::sessions, Files::sessionsOld);
+    exported = 0;
+  }
+
+  QByteArray bytes;
+  if (exported == 0) {
+    bytes.append(EXPORT_HEADER);
+  }
+
+  // Content ids are file paths which may contain commas
+  QString contentId = session.contentId;
+  contentId.replace('"', "\"\"");
+
+  bytes.append(QString("\"%1\",%2,%3,%4,%5,%6,%7\n")
+                   .arg(contentId)
+                   .arg(session.start / 1000)
+                   .arg(session.end / 1000)
+                   .arg(session.startProgress)
+                   .arg(session.endProgress)
+                   .arg(session.pages)
+                   .arg(session.pagesPerMinute, 0, 'f', 2)
+                   .toUtf8());
+
+  writer->append(Files::sessions, bytes);
+  exported += bytes.size();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QList>
+#include <QObject>
+#include <QString>
+
+// Page turns of the last few reading sessions, summarised into one record per session once the book is closed
+class SessionLog : public QObject {
+  Q_OBJECT
+
+public:
+  struct Session {
+    QString contentId;
+    qint64 start; // Milliseconds since epoch
+    qint64 end;
+    int startProgress;
+    int endProgress;
+    int pages;
+    double pagesPerMinute;
+  };
+
+  static SessionLog *getInstance();
+
+  void begin(QString contentId, int progress);
+  void record(QString contentId, int progress, int pages);
+  void end();
+
+  const Session *last(QString contentId);
+  qint64 lastRead(QString contentId);
+
+private:
+  // Progress after one or more page turns, the content id is shared with the open book so storing it doesn't allocate
+  struct Sample {
+    qint64 timestamp;
+    QString contentId;
+    int progress;
+  };
+
+  static const int SAMPLES = 512;
+
+  SessionLog(QObject *parent = nullptr);
+
+  static SessionLog *instance;
+
+  void sample(qint64 timestamp, QString contentId, int progress);
+  void save(const Session &session);
+
+  Sample samples[SAMPLES];
+  int head = 0;
+
+  // The session being read, kept apart from the samples so a long session outliving the buffer is still summarised
+  bool reading = false;
+  Session current;
+  qint64 active = 0;
+
+  QList<Session> sessions;
+
+  // Size of the export, unknown until the first session is saved
+  qint64 exported = -1;
+};
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 
 #include "cli.h"
+#include "cliprocess.h"
+#include "diskwriter.h"
 #include "settings.h"
 #include "synccontroller.h"
 
@@ -20,74 +22,263 @@ Settings *Settings::getInstance() {
   return instance;
 };
 
+// Read by the command line once when it starts, a running co-process doesn't see them change
+static const char *CLI_KEYS[] = {"authorization", "debug", "journal_privacy", "sqlite_path", "sync_bookmarks"};
+
 Settings::Settings(QObject *parent)
-    : QObject(parent), internal(new QSettings(Files::settings, QSettings::IniFormat)),
-      config(new QSettings(Files::config, QSettings::IniFormat)),
-      kobo(new QSettings(Files::koboSettings, QSettings::IniFormat)) {
+    : QObject(parent), books(Files::books), kobo(new QSettings(Files::koboSettings, QSettings::IniFormat)) {
+  if (!QFile::exists(Files::books) && QFile::exists(Files::settings)) {
+    migrate();
+  }
+
+  // Later reads only ever use the copy in memory
+  QSettings file(Files::config, QSettings::IniFormat);
+  foreach (const QString &key, file.allKeys()) {
+    config.insert(key, file.value(key));
+  }
+
+  parse();
+
+  QObject::connect(DiskWriter::getInstance(), &DiskWriter::settingsRead, this, &Settings::configRead);
+
+  watcher->addPath(Files::config);
+  QObject::connect(watcher, &QFileSystemWatcher::fileChanged, this, &Settings::configChanged);
+
   QObject::connect(SyncController::getInstance(), &SyncController::currentViewChanged, this,
                    &Settings::currentViewChanged);
 };
 
+// Books used to be groups in settings.ini which QSettings rewrites in full on every change
+void Settings::migrate() {
+  QSettings internal(Files::settings, QSettings::IniFormat);
+  QHash<QByteArray, BookStore::Book> entries;
+
+  foreach (const QString &group, internal.childGroups()) {
+    internal.beginGroup(group);
+
+    QVariant enabled = internal.value("enabled");
+    BookStore::Book book = {enabled.isNull() ? BookStore::ENABLED_UNSET : char(enabled.toBool()),
+                            internal.value("progress").toInt(), internal.value("linkedbook").toString()};
+
+    internal.endGroup();
+
+    // Groups are already named by getKey
+    entries.insert(group.toUtf8(), book);
+  }
+
+  books.reset(entries);
+
+  if (!DiskWriter::getInstance()->flush(true)) {
+    nh_log("Failed to migrate %s, keeping it", Files::settings);
+    return;
+  }
+
+  nh_log("Migrated %d books from %s", entries.size(), Files::settings);
+  QFile::remove(Files::settings);
+}
+
 void Settings::currentViewChanged(QString name) {
+  // The watcher misses changes made over USB while the partition was exported, so check when a book opens too
   if (name == "ReadingView") {
-    internal->sync();
-    config->sync();
+    read();
+  }
+}
+
+// Pending changes are handed to the writer first, so the read sees every change made up to now
+void Settings::read() {
+  reads.enqueue(changes);
+  DiskWriter::getInstance()->read(Files::config);
+}
+
+// The co-process only reads config.ini on start
+void Settings::reloadCLI() {
+  DiskWriter::getInstance()->flush(true);
+  changed();
+  CLIProcess::getInstance()->reload();
+}
+
+void Settings::configRead(QString path, QVariantHash values) {
+  if (path != Files::config)
+    return;
+
+  int seen = reads.isEmpty() ? changes : reads.dequeue();
+
+  // The snapshot is built from what was read plus the changes still being written, never from older values in memory
+  QHash<QString, Change>::iterator i = dirty.begin();
+  while (i != dirty.end()) {
+    // Written before the read so the file has it, from now on changes to the file win
+    if (i->number <= seen) {
+      i = dirty.erase(i);
+      continue;
+    }
+
+    // Changed since the read was requested, so newer than what was read
+    if (i->value.isNull()) {
+      values.remove(i.key());
+    } else {
+      values.insert(i.key(), i->value);
+    }
+    ++i;
+  }
+
+  if (values == config)
+    return;
+
+  nh_log("Reloading %s", Files::config);
+
+  bool restart = false;
+  for (const char *key : CLI_KEYS) {
+    restart = restart || values.value(key) != config.value(key);
+  }
+
+  config = values;
+  parse();
+
+  if (restart) {
+    reloadCLI();
+  } else {
+    changed();
+  }
+}
+
+// Each field converted and checked once so getters only return it
+void Settings::parse() {
+  Config *parsed = new Config();
+
+  parsed->autoSyncDefault = config.value("auto_sync_default", false).toBool();
+  parsed->syncBookmarks = config.value("sync_bookmarks", "never").toString().toLower();
+  parsed->journalPrivacy = config.value("journal_privacy", "public").toString().toLower();
+  parsed->retryOnNetwork = config.value("retry_on_network", false).toBool();
+
+  int hour = config.value("sync_daily", -1).toInt();
+  parsed->syncDaily = hour >= 0 && hour <= 23 ? hour : -1;
+
+  QVariant syncOnClose = config.value("sync_on_close", "always");
+  int closeThreshold = syncOnClose.toInt();
+  if (syncOnClose.toString().toLower() == "always") {
+    parsed->closeThreshold = 1;
+  } else if (closeThreshold > 0 && closeThreshold < 100) {
+    parsed->closeThreshold = closeThreshold;
+  } else {
+    parsed->closeThreshold = 0;
   }
+
+  int threshold = config.value("threshold").toInt();
+  parsed->pageThreshold = threshold > 0 && threshold < 100 ? threshold : 0;
+
+  int max = config.value("max_requests", 2).toInt();
+  parsed->maxRequests = max > 0 ? max : 1;
+
+  parsed->wifiLinger = config.value("wifi_linger", 60).toInt();
+  parsed->debug = config.value("debug").toBool();
+
+  // Anyone still holding the old snapshot keeps a consistent view of it
+  snapshot = QSharedPointer<const Config>(parsed);
 }
 
-QString Settings::getPath(QString contentId, QString key) {
-  return contentId.replace('/', '-').replace('\\', '-') + "/" + key;
+QSharedPointer<const Settings::Config> Settings::getSnapshot() { return snapshot; }
+
+void Settings::configChanged(QString path) {
+  // Editors often replace the file rather than write to it, which drops it from the watcher
+  if (!watcher->files().contains(path) && QFile::exists(path)) {
+    watcher->addPath(path);
+  }
+
+  read();
 }
 
-void Settings::setValue(QString contentId, QString key, QVariant value) {
+void Settings::setConfig(QString key, QVariant value) {
   if (value.isNull()) {
-    internal->remove(getPath(contentId, key));
+    config.remove(key);
   } else {
-    internal->setValue(getPath(contentId, key), value);
+    config.insert(key, value);
   }
+
+  parse();
+
+  dirty.insert(key, {++changes, value});
+  DiskWriter::getInstance()->setValue(Files::config, key, value);
 }
 
-QVariant Settings::getValue(QString contentId, QString key, QVariant defaultValue) {
-  return internal->value(getPath(contentId, key), defaultValue);
+void Settings::setBook(QString contentId, const BookStore::Book &book) {
+  books.set(contentId, book);
+  bookChanged(contentId);
 }
 
-void Settings::setEnabled(QString contentId, bool value) { setValue(contentId, "enabled", value); }
+void Settings::setEnabled(QString contentId, bool value) {
+  BookStore::Book book = books.get(contentId);
+  book.enabled = value;
+  setBook(contentId, book);
+}
 
 bool Settings::isEnabled(QString contentId) {
-  bool defaultValue = config->value("auto_sync_default", false).toBool();
-  return getValue(contentId, "enabled", defaultValue).toBool();
+  char enabled = books.get(contentId).enabled;
+  if (enabled == BookStore::ENABLED_UNSET)
+    return snapshot->autoSyncDefault;
+
+  return enabled;
 }
 
-void Settings::setLinkedId(QString contentId, QString value) { setValue(contentId, "linkedbook", value); }
+void Settings::setLinkedId(QString contentId, QString value) {
+  BookStore::Book book = books.get(contentId);
+  book.linkedId = value;
+  setBook(contentId, book);
+}
+
+QString Settings::getLinkedId(QString contentId) { return books.get(contentId).linkedId; }
 
-QString Settings::getLinkedId(QString contentId) { return getValue(contentId, "linkedbook").toString(); }
+void Settings::setLastProgress(QString contentId, int value) {
+  BookStore::Book book = books.get(contentId);
+  book.progress = value;
+  setBook(contentId, book);
+}
 
-void Settings::setLastProgress(QString contentId, int value) { setValue(contentId, "progress", value); }
+int Settings::getLastProgress(QString contentId) { return books.get(contentId).progress; }
 
-int Settings::getLastProgress(QString contentId) { return getValue(contentId, "progress").toInt(); }
+int Settings::getBookCount() { return books.count(); }
 
-void Settings::setSyncDaily(int value) { config->setValue("sync_daily", value); }
+// Drop every book not in the given list of books on the device and rewrite the store without them
+void Settings::collectGarbage(QStringList contentIds, int &entries, qint64 &bytes) {
+  books.collectGarbage(contentIds, entries, bytes);
 
-int Settings::getSyncDaily() {
-  int hour = config->value("sync_daily", -1).toInt();
-  return hour >= 0 && hour <= 23 ? hour : -1;
+  nh_log("Removed %d books no longer on the device, reclaiming %lld bytes", entries, bytes);
+  changed();
 }
 
-void Settings::setAutoSyncDefault(bool value) { config->setValue("auto_sync_default", value); }
+void Settings::setSyncDaily(int value) {
+  setConfig("sync_daily", value);
+  changed();
+}
 
-bool Settings::getAutoSyncDefault() { return config->value("auto_sync_default", false).toBool(); }
+int Settings::getSyncDaily() { return snapshot->syncDaily; }
 
-void Settings::setSyncBookmarks(QString value) { config->setValue("sync_bookmarks", value); }
+void Settings::setAutoSyncDefault(bool value) {
+  setConfig("auto_sync_default", value);
+  changed();
+}
 
-QString Settings::getSyncBookmarks() { return config->value("sync_bookmarks", "never").toString().toLower(); }
+bool Settings::getAutoSyncDefault() { return snapshot->autoSyncDefault; }
 
-void Settings::setJournalPrivacy(QString value) { config->setValue("journal_privacy", value); }
+void Settings::setSyncBookmarks(QString value) {
+  setConfig("sync_bookmarks", value);
+  reloadCLI();
+}
+
+QString Settings::getSyncBookmarks() { return snapshot->syncBookmarks; }
 
-QString Settings::getJournalPrivacy() { return config->value("journal_privacy", "public").toString().toLower(); }
+void Settings::setJournalPrivacy(QString value) {
+  setConfig("journal_privacy", value);
+  reloadCLI();
+}
 
-void Settings::setRetryOnNetwork(bool value) { config->setValue("retry_on_network", value); }
+QString Settings::getJournalPrivacy() { return snapshot->journalPrivacy; }
 
-bool Settings::isRetryOnNetwork() { return config->value("retry_on_network", false).toBool(); }
+void Settings::setRetryOnNetwork(bool value) {
+  setConfig("retry_on_network", value);
+  changed();
+}
+
+bool Settings::isRetryOnNetwork() { return snapshot->retryOnNetwork; }
 
 void Settings::setCloseThreshold(int value) {
   QVariant realValue = "never";
@@ -98,42 +289,33 @@ void Settings::setCloseThreshold(int value) {
     realValue = value;
   }
 
-  config->setValue("sync_on_close", realValue);
+  setConfig("sync_on_close", realValue);
+  changed();
 }
 
-int Settings::getCloseThreshold() {
-  QVariant syncOnClose = config->value("sync_on_close", "always");
-  if (syncOnClose.toString().toLower() == "always") {
-    return 1;
-  }
+int Settings::getCloseThreshold() { return snapshot->closeThreshold; }
 
-  int threshold = syncOnClose.toInt();
-  if (threshold > 0 && threshold < 100) {
-    return threshold;
-  }
+int Settings::getPageThreshold() { return snapshot->pageThreshold; }
 
-  return 0;
+void Settings::setPageThreshold(int value) {
+  setConfig("threshold", value > 0 && value < 100 ? value : 0);
+  changed();
 }
 
-int Settings::getPageThreshold() {
-  int threshold = config->value("threshold").toInt();
-  if (threshold > 0 && threshold < 100) {
-    return threshold;
-  }
-
-  return 0;
-}
+int Settings::getMaxRequests() { return snapshot->maxRequests; }
 
-void Settings::setPageThreshold(int value) { config->setValue("threshold", value > 0 && value < 100 ? value : 0); }
+int Settings::getWifiLinger() { return snapshot->wifiLinger; }
 
 void Settings::setDebug(bool value) {
   if (value) {
-    config->setValue("debug", value);
+    setConfig("debug", value);
   } else {
-    config->remove("debug");
+    setConfig("debug", QVariant());
   }
+
+  reloadCLI();
 }
 
-bool Settings::getDebug() { return config->value("debug").toBool(); }
+bool Settings::getDebug() { return snapshot->debug; }
 
 bool Settings::is24HourClock() { return kobo->value("ApplicationPreferences/is24HourClock").toBool(); }
@@ -1,16 +1,39 @@
+#pragma once
+
 #include <QDateTime>
+#include <QFileSystemWatcher>
 #include <QObject>
+#include <QHash>
+#include <QQueue>
 #include <QSettings>
+#include <QSharedPointer>
 #include <QVariant>
 
+#include "bookstore.h"
 #include "files.h"
 
 class Settings : public QObject {
   Q_OBJECT
 
 public:
+  // config.ini parsed into its final types, never changed once built
+  struct Config {
+    bool autoSyncDefault;
+    QString syncBookmarks;
+    QString journalPrivacy;
+    bool retryOnNetwork;
+    int syncDaily;
+    int closeThreshold;
+    int pageThreshold;
+    int maxRequests;
+    int wifiLinger;
+    bool debug;
+  };
+
   static Settings *getInstance();
 
+  QSharedPointer<const Config> getSnapshot();
+
   void setEnabled(QString contentId, bool value);
   bool isEnabled(QString contentId);
 
@@ -20,6 +43,9 @@ public:
   void setLastProgress(QString contentId, int value);
   int getLastProgress(QString contentId);
 
+  int getBookCount();
+  void collectGarbage(QStringList contentIds, int &entries, qint64 &bytes);
+
   void setAutoSyncDefault(bool value);
   bool getAutoSyncDefault();
 
@@ -41,6 +67,9 @@ public:
   void setPageThreshold(int value);
   int getPageThreshold();
 
+  int getMaxRequests();
+  int getWifiLinger();
+
   void setDebug(bool value);
   bool getDebug();
 
@@ -48,17 +77,43 @@ public:
 
 public Q_SLOTS:
   void currentViewChanged(QString name);
+  void configRead(QString path, QVariantHash values);
+  void configChanged(QString path);
+
+Q_SIGNALS:
+  // Global settings changed, changes to a single book only emit bookChanged()
+  void changed();
+  void bookChanged(QString contentId);
 
 private:
   Settings(QObject *parent = nullptr);
 
   static Settings *instance;
 
-  QSettings *internal = nullptr;
-  QSettings *config = nullptr;
+  BookStore books;
+  QVariantHash config;
+
+  // A value set here that a read of the file may not include yet, null when the key was removed
+  struct Change {
+    int number;
+    QVariant value;
+  };
+
+  // Keys changed here until a read that comes after the change is written
+  QHash<QString, Change> dirty;
+  int changes = 0;
+
+  // The number of the last change made before each read still in flight
+  QQueue<int> reads;
+  QSharedPointer<const Config> snapshot;
+  QFileSystemWatcher *watcher = new QFileSystemWatcher(this);
   QSettings *kobo = nullptr;
 
-  QString getPath(QString contentId, QString key);
-  void setValue(QString contentId, QString key, QVariant value);
-  QVariant getValue(QString contentId, QString key, QVariant defaultValue = QVariant());
+  void reloadCLI();
+  void read();
+  void parse();
+  void setConfig(QString key, QVariant value);
+  void migrate();
+
+  void setBook(QString contentId, const BookStore::Book &book);
 };
@@ -1,8 +1,10 @@
 #include <QDateTime>
+#include <QJsonArray>
 #include <QVBoxLayout>
 
 #include <NickelHook.h>
 
+#include "../alarmscheduler.h"
 #include "../cli.h"
 #include "../settings.h"
 #include "../synccontroller.h"
@@ -208,6 +210,7 @@ QFrame *SettingsDialog::buildGeneral() {
 
   CLI::Options options;
   options.silent = true;
+  options.owner = this;
 
   CLI *cli = CLI::getUser(options);
   QObject::connect(cli, &CLI::response, this, &SettingsDialog::setUsername);
@@ -297,7 +300,7 @@ QFrame *SettingsDialog::buildInformation() {
   layout->addWidget(new Label(Label::Avenir, "Book information"));
 
   SyncController *ctl = SyncController::getInstance();
-  QDateTime alarm = ctl->getAlarm();
+  const QDateTime &alarm = AlarmScheduler::getInstance()->getNext();
   StaticRow *row =
       new StaticRow("Auto-sync scheduled for", alarm.isValid() ? alarm.toLocalTime().toString() : "Never", false);
   layout->addWidget(row);
@@ -332,6 +335,14 @@ QFrame *SettingsDialog::buildAdvanced() {
   QObject::connect(menuRow, &MenuRow::triggered, this, &SettingsDialog::saveLogs);
   layout->addWidget(menuRow);
 
+  menuRow = new MenuRow("Remove settings of deleted books", MenuRowType::Tap, {{"Clean up", true}}, {}, true);
+  QObject::connect(menuRow, &MenuRow::triggered, this, &SettingsDialog::collectGarbage);
+  layout->addWidget(menuRow);
+  menuRow->setProperty("noBorder", true);
+
+  storedBooks = new StaticRow("Stored book settings", QString::number(Settings::getInstance()->getBookCount()), false);
+  layout->addWidget(storedBooks);
+
   return frame;
 }
 
@@ -372,3 +383,32 @@ void SettingsDialog::clearLastSynced() {
 void SettingsDialog::setDebug(bool value) { Settings::getInstance()->setDebug(value); }
 
 void SettingsDialog::saveLogs() { nh_dump_log(); }
+
+void SettingsDialog::collectGarbage() {
+  CLI::Options options;
+  options.owner = this;
+
+  CLI *cli = CLI::listContent(options);
+  QObject::connect(cli, &CLI::response, this, &SettingsDialog::garbageCollected);
+}
+
+void SettingsDialog::garbageCollected(QJsonObject doc) {
+  QStringList contentIds;
+  foreach (const QJsonValue &value, doc.value("content_ids").toArray()) {
+    contentIds.append(value.toString());
+  }
+
+  // An empty library is much more likely a failed read than every book deleted
+  if (contentIds.isEmpty())
+    return;
+
+  int entries = 0;
+  qint64 bytes = 0;
+  Settings::getInstance()->collectGarbage(contentIds, entries, bytes);
+  entries += SyncController::getInstance()->collectGarbage(contentIds);
+
+  storedBooks->setValue(QString("%1 (removed %2, %3 KB reclaimed)")
+                            .arg(Settings::getInstance()->getBookCount())
+                            .arg(entries)
+                            .arg(qMax(bytes, qint64(0)) / 1024));
+}
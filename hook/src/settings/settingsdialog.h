@@ -23,6 +23,8 @@ public Q_SLOTS:
 
   void setDebug(bool value);
   void saveLogs();
+  void collectGarbage();
+  void garbageCollected(QJsonObject doc);
 
   void clearReadProgress();
   void clearLastSynced();
@@ -34,6 +36,7 @@ private:
 
   PagedStack *pages = nullptr;
   StaticRow *username = nullptr;
+  StaticRow *storedBooks = nullptr;
 
   QFrame *buildGeneral();
   QFrame *buildAutoSync();
@@ -4,6 +4,12 @@
 #include <QSettings>
 #include <QTimer>
 
+#include <stdlib.h>
+
+#include "alarmscheduler.h"
+#include "diskwriter.h"
+#include "outbox.h"
+#include "sessionlog.h"
 #include "settings.h"
 #include "synccontroller.h"
 
@@ -17,7 +23,21 @@ SyncController *SyncController::getInstance() {
   return instance;
 };
 
-SyncController::SyncController(QObject *parent) : QObject(parent) {};
+// Milliseconds without a page turn before the progress is sampled
+static const int DEBOUNCE = 1000;
+
+// Milliseconds the sync started as the Kobo goes to sleep has to finish
+static const int SLEEP_BUDGET = 10000;
+
+SyncController::SyncController(QObject *parent) : QObject(parent) {
+  debounce->setSingleShot(true);
+  QObject::connect(debounce, &QTimer::timeout, this, &SyncController::settle);
+  QObject::connect(AlarmScheduler::getInstance(), &AlarmScheduler::fired, this, &SyncController::alarm);
+
+  // Send whatever was left in the outbox before the last reboot if we're already online. Yields as sending needs
+  // Settings, which needs this controller to be fully created.
+  QTimer::singleShot(0, this, [] { Outbox::getInstance()->drain(); });
+};
 
 void SyncController::currentViewIndexChanged(int index) {
   if (index < 0)
@@ -25,6 +45,12 @@ void SyncController::currentViewIndexChanged(int index) {
 
   queue->failed = false;
 
+  // Catch up on page turns before the book is closed or the Kobo sleeps
+  if (turns > 0) {
+    debounce->stop();
+    sample();
+  }
+
   MainWindowController *mwc = MainWindowController__sharedInstance();
   QWidget *cv = MainWindowController__currentView(mwc);
   QString name = cv->objectName();
@@ -34,78 +60,132 @@ void SyncController::currentViewIndexChanged(int index) {
     currentViewChanged(name);
   }
 
-  QDateTime alarm = getAlarm();
-  if (name.endsWith("DragonPowerView") && alarm.isValid()) {
-    nh_log("Alarm set for %s", qPrintable(alarm.toString()));
+  if (lastViewName == "ReadingView" && name != "ReadingView") {
+    SessionLog::getInstance()->end();
   }
 
-  if (syncDisabled) {
-    return;
+  if (name == "ReadingView") {
+    if (lastViewName != "ReadingView") {
+      SessionLog::getInstance()->begin(contentId, ReadingView__getCalculatedReadProgress(cv));
+    }
+
+    readingView = cv;
+    QObject::connect(cv, SIGNAL(pageChanged(int)), this, SLOT(pageChanged()), Qt::UniqueConnection);
+  }
+
+  const QDateTime &alarm = AlarmScheduler::getInstance()->getNext();
+  if (name.endsWith("DragonPowerView") && alarm.isValid()) {
+    nh_log("Alarm set for %s", qPrintable(alarm.toString()));
   }
 
   Settings *settings = Settings::getInstance();
-  if (lastViewName == "ReadingView" &&
+  if (!syncDisabled && lastViewName == "ReadingView" &&
       (name.endsWith("DragonPowerView") || MainWindowController__viewWithObjectName(mwc, "ReadingView") == nullptr) &&
       settings->isEnabled(contentId) && queue->checkThreshold(contentId, settings->getCloseThreshold())) {
     nh_log("Triggered on close auto-sync");
-    queue->run(contentId);
+
+    // Nickel freezes everything once it suspends, so only send what can finish before then
+    if (name.endsWith("DragonPowerView")) {
+      queue->runBeforeSleep(contentId, SLEEP_BUDGET);
+    } else {
+      queue->run(contentId);
+    }
+  }
+
+  // Nothing written behind should be lost if the Kobo doesn't wake up again. Only once the pre-sleep sync is on its
+  // way, blocking first would eat into its budget. Whatever it changes is written again once it is done.
+  if (name.endsWith("DragonPowerView")) {
+    DiskWriter::getInstance()->flush(true);
+  }
+
+  if (syncDisabled) {
+    return;
   }
 
   if (name == "ReadingView") {
-    if (settings->isEnabled(contentId)) {
+    // The open book may have changed
+    invalidatePolicy();
+
+    if (getPolicy().enabled) {
       queue->updateReadProgress(contentId);
     }
-
-    QObject::connect(cv, SIGNAL(pageChanged(int)), this, SLOT(pageChanged()), Qt::UniqueConnection);
   }
 
   lastViewName = name;
 }
 
+// Runs on every page turn so stays clear of settings, logging and allocations
 void SyncController::pageChanged() {
-  nh_log("SyncController::pageChanged()");
+  turns++;
+  lastTurn.start();
 
-  if (syncDisabled) {
+  if (!debounce->isActive()) {
+    debounce->start(DEBOUNCE);
+  }
+}
+
+void SyncController::settle() {
+  qint64 elapsed = lastTurn.elapsed();
+  if (elapsed < DEBOUNCE) {
+    debounce->start(DEBOUNCE - elapsed);
     return;
   }
 
-  Settings *settings = Settings::getInstance();
+  sample();
+}
 
-  if (!settings->isEnabled(contentId))
-    return;
+void SyncController::invalidatePolicy() { policy.valid = false; }
 
-  MainWindowController *mwc = MainWindowController__sharedInstance();
-  QWidget *cv = MainWindowController__currentView(mwc);
-  QString name = cv->objectName();
-  if (name == "ReadingView") {
-    queue->updateReadProgress(contentId);
+void SyncController::bookChanged(QString contentId) {
+  if (contentId == this->contentId) {
+    invalidatePolicy();
   }
+}
 
-  int syncDaily = settings->getSyncDaily();
+const SyncController::Policy &SyncController::getPolicy() {
+  if (policy.valid)
+    return policy;
 
-  if (timer != nullptr && (PowerTimer__timeRemaining(timer) <= 0 || syncDaily != lastSyncDaily)) {
-    timer->deleteLater();
-    timer = nullptr;
+  Settings *settings = Settings::getInstance();
+  QObject::connect(settings, &Settings::changed, this, &SyncController::invalidatePolicy, Qt::UniqueConnection);
+  QObject::connect(settings, &Settings::bookChanged, this, &SyncController::bookChanged, Qt::UniqueConnection);
+
+  policy.enabled = settings->isEnabled(contentId);
+  policy.pageThreshold = settings->getSnapshot()->pageThreshold;
+  policy.lastProgress = settings->getLastProgress(contentId);
+  policy.valid = true;
+
+  return policy;
+}
+
+void SyncController::sample() {
+  int pages = turns;
+  turns = 0;
+
+  if (pages == 0 || readingView.isNull())
+    return;
+
+  int value = ReadingView__getCalculatedReadProgress(readingView);
+  SessionLog::getInstance()->record(contentId, value, pages);
+
+  if (syncDisabled) {
+    return;
   }
 
-  lastSyncDaily = syncDaily;
+  if (!getPolicy().enabled)
+    return;
 
-  if (timer == nullptr && syncDaily >= 0 && queue->checkThreshold(contentId, 1)) {
-    timer = construct_PowerTimer("NickelHardcover-alarm", this);
+  queue->updateReadProgress(contentId, value);
 
-    QDateTime time = QDateTime::currentDateTime();
-    if (time.time().hour() >= syncDaily) {
-      time = time.addDays(1);
-    }
-    time.setTime(QTime(syncDaily, 0));
-    nh_log("Setting alarm for %s", qPrintable(time.toString()));
+  int progress = queue->getReadProgress(contentId);
+  int delta = abs(policy.lastProgress - progress);
 
-    PowerTimer__fireAt(timer, time);
-    QObject::connect(timer, SIGNAL(timeout()), this, SLOT(alarm()));
+  if (progress > 0 && delta >= 1) {
+    AlarmScheduler::getInstance()->arm();
   }
 
-  if (!queue->failed && ((queue->getReadProgress(contentId) == 100 && settings->getLastProgress(contentId) != 100) ||
-                         queue->checkThreshold(contentId, settings->getPageThreshold()))) {
+  if (!queue->failed && ((progress == 100 && policy.lastProgress != 100) ||
+                         (policy.pageThreshold > 0 && progress > 0 && delta >= policy.pageThreshold))) {
     nh_log("Triggered threshold auto-sync");
     queue->run(contentId);
   }
@@ -113,9 +193,6 @@ void SyncController::pageChanged() {
 
 void SyncController::alarm() {
   nh_log("SyncController::alarm()");
-
-  timer->deleteLater();
-  timer = nullptr;
   queue->runAll();
 }
 
@@ -123,16 +200,10 @@ int SyncController::getReadProgress() { return queue->getReadProgress(contentId)
 
 void SyncController::clearReadProgress() { queue->clearReadProgress(contentId); }
 
+int SyncController::collectGarbage(const QStringList &contentIds) { return queue->collectGarbage(contentIds); }
+
 void SyncController::manualSync() {
   nh_log("SyncController::manualSync()");
   queue->updateReadProgress(contentId);
   queue->run(contentId, true);
 }
-
-QDateTime SyncController::getAlarm() {
-  if (timer != nullptr && PowerTimer__timeRemaining(timer) > 0) {
-    return QDateTime::currentDateTime().addMSecs(PowerTimer__timeRemaining(timer));
-  }
-
-  return QDateTime();
-}
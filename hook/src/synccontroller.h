@@ -1,7 +1,12 @@
+#pragma once
+
+#include <QElapsedTimer>
 #include <QLabel>
 #include <QNetworkAccessManager>
 #include <QObject>
+#include <QPointer>
 #include <QSettings>
+#include <QTimer>
 
 #include "nickelhardcover.h"
 #include "syncqueue.h"
@@ -21,24 +26,44 @@ public:
   int getReadProgress();
   void clearReadProgress();
   void manualSync();
-  QDateTime getAlarm();
+  int collectGarbage(const QStringList &contentIds);
 
 public Q_SLOTS:
   void currentViewIndexChanged(int index);
   void pageChanged();
+  void settle();
+  void invalidatePolicy();
+  void bookChanged(QString contentId);
   void alarm();
 
 Q_SIGNALS:
   void currentViewChanged(QString name);
 
 private:
+  // Settings for the open book, read once instead of on every page turn
+  struct Policy {
+    bool valid = false;
+    bool enabled;
+    int pageThreshold;
+    int lastProgress;
+  };
+
   SyncController(QObject *parent = nullptr);
 
   static SyncController *instance;
 
-  PowerTimer *timer = nullptr;
+  const Policy &getPolicy();
+  void sample();
+
+  Policy policy;
+
+  // Page turns not yet sampled, sampled once the reader stops flipping through pages
+  QPointer<QWidget> readingView;
+  QTimer *debounce = new QTimer(this);
+  QElapsedTimer lastTurn;
+  int turns = 0;
+
   SyncQueue *queue = new SyncQueue(this);
 
   QString lastViewName;
-  int lastSyncDaily = 0;
 };
@@ -1,22 +1,287 @@
 #include <NickelHook.h>
 #include <QDateTime>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QLabel>
+#include <QSet>
 #include <QSettings>
 #include <QTimer>
+#include <QtEndian>
 
+#include "alarmscheduler.h"
+#include "diskwriter.h"
+#include "files.h"
+#include "sessionlog.h"
 #include "settings.h"
-#include "syncqueue.h"
+#include "synccontroller.h"
+#include "wifisession.h"
 
-SyncQueue::SyncQueue(QObject *parent) : QObject(parent) {
-  WirelessManager *wm = WirelessManager__sharedInstance();
-  QObject::connect(wm, SIGNAL(networkConnected()), this, SLOT(networkConnected()));
+// Each book is stored as its progress, flags, retry attempts, failure reason and when to retry
+static const int RECORD_SIZE = 4 + 1 + 1 + 1 + 8;
+static const char RETRY = 0x01;
+
+// Books synced at the same time by automatic syncs, a batch counts as one
+static const int MAX_SYNCS = 2;
+
+// Books sent as the Kobo goes to sleep, anything more is unlikely to make it in time
+static const int MAX_SLEEP_BOOKS = 3;
+
+struct RetryPolicy {
+  CLI::FailureReason reason;
+  int attempts;   // Scheduled retries before giving up
+  int delay;      // Seconds before the first retry, doubled for each one after
+  int maxDelay;   // Seconds
+  bool onNetwork; // Also retried when WiFi connects if retry_on_network is set, even once out of attempts
 };
 
+// clang-format off
+static const RetryPolicy policies[] = {
+  { .reason = CLI::FailureReason::Network,      .attempts = 4, .delay = 900, .maxDelay = 4 * 3600, .onNetwork = true  },
+  { .reason = CLI::FailureReason::Timeout,      .attempts = 4, .delay = 300, .maxDelay = 2 * 3600, .onNetwork = true  },
+  { .reason = CLI::FailureReason::Error,        .attempts = 5, .delay = 120, .maxDelay = 6 * 3600, .onNetwork = false },
+  { .reason = CLI::FailureReason::BookNotFound, .attempts = 0, .delay = 0,   .maxDelay = 0,        .onNetwork = false }, // Needs the book linked
+};
+// clang-format on
+
+static const RetryPolicy *getPolicy(CLI::FailureReason reason) {
+  for (const RetryPolicy &policy : policies) {
+    if (policy.reason == reason) {
+      return &policy;
+    }
+  }
+
+  return &policies[0];
+}
+
+// Milliseconds to wait before the given retry
+static qint64 backoff(const RetryPolicy *policy, int attempt) {
+  qint64 delay = qMin(qint64(policy->delay) << qMin(attempt - 1, 16), qint64(policy->maxDelay));
+
+  // Half of it random so retries from many devices don't line up
+  return (delay / 2 + qrand() % (delay / 2 + 1)) * 1000;
+}
+
+SyncQueue::SyncQueue(QObject *parent) : QObject(parent), store(Files::queue) {
+  qsrand(uint(QDateTime::currentMSecsSinceEpoch()));
+
+  deadline->setSingleShot(true);
+  QObject::connect(deadline, &QTimer::timeout, this, &SyncQueue::sleepDeadline);
+  QObject::connect(WifiSession::getInstance(), &WifiSession::flush, this, &SyncQueue::networkConnected);
+  load();
+  schedule();
+};
+
+void SyncQueue::load() {
+  const QHash<QByteArray, QByteArray> &entries = store.entries();
+
+  QHash<QByteArray, QByteArray>::const_iterator i = entries.constBegin();
+  while (i != entries.constEnd()) {
+    QString contentId = QString::fromUtf8(i.key());
+    const QByteArray &value = i.value();
+    ++i;
+
+    if (value.size() != RECORD_SIZE)
+      continue;
+
+    const uchar *data = reinterpret_cast<const uchar *>(value.constData());
+
+    int saved = qFromLittleEndian<qint32>(data);
+    if (saved > 0) {
+      progress.insert(contentId, saved);
+    }
+
+    if (data[4] & RETRY) {
+      Book &book = books[contentId];
+      book.state = State::RetryWait;
+      book.attempts = data[5];
+      book.reason = CLI::FailureReason(data[6]);
+      book.retryAt = qFromLittleEndian<qint64>(data + 7);
+    }
+  }
+
+  nh_log("Loaded %d queued books and %d retries", progress.size(), books.size());
+
+  // Progress left from before a restart still needs the daily sync. Yields as this runs while SyncController, which
+  // Settings needs, is being created.
+  if (!progress.isEmpty()) {
+    QTimer::singleShot(0, this, [] { AlarmScheduler::getInstance()->arm(); });
+  }
+}
+
+void SyncQueue::persist(QString contentId) {
+  int value = progress.value(contentId);
+  Book book = books.value(contentId);
+  bool retry = book.state == State::RetryWait;
+
+  if (value == 0 && !retry) {
+    store.remove(contentId.toUtf8());
+    return;
+  }
+
+  QByteArray record(RECORD_SIZE, Qt::Uninitialized);
+  uchar *data = reinterpret_cast<uchar *>(record.data());
+  qToLittleEndian<qint32>(value, data);
+  data[4] = retry ? RETRY : 0;
+  data[5] = uchar(qMin(book.attempts, 255));
+  data[6] = uchar(book.reason);
+  qToLittleEndian<qint64>(book.retryAt, data + 7);
+
+  store.put(contentId.toUtf8(), record);
+}
+
+bool SyncQueue::Priority::operator<(const Priority &other) const {
+  if (complete != other.complete)
+    return complete;
+
+  if (open != other.open)
+    return open;
+
+  if (delta != other.delta)
+    return delta > other.delta;
+
+  // The book read last is likely the one the user checks on Hardcover.app first
+  if (read != other.read)
+    return read > other.read;
+
+  return sequence < other.sequence;
+}
+
+void SyncQueue::enqueue(QString contentId) {
+  Book &book = books[contentId];
+
+  if (book.state == State::InFlight) {
+    nh_log("%s is already syncing, syncing again once it's done", qPrintable(contentId));
+    book.resend = true;
+    return;
+  }
+
+  // Keep the place of a book already waiting so updating its progress doesn't send it to the back
+  if (book.state == State::Queued) {
+    queue.remove(book.priority);
+  } else {
+    book.state = State::Queued;
+    book.priority.sequence = sequence++;
+    book.retryAt = 0;
+  }
+
+  int value = progress.value(contentId);
+  int last = Settings::getInstance()->getLastProgress(contentId);
+
+  book.priority.complete = value == 100 && last != 100;
+  book.priority.open = contentId == SyncController::getInstance()->contentId;
+  book.priority.delta = abs(value - last);
+  book.priority.read = SessionLog::getInstance()->lastRead(contentId);
+
+  queue.insert(book.priority, contentId);
+  persist(contentId);
+}
+
+void SyncQueue::dequeue(QString contentId) {
+  QHash<QString, Book>::iterator i = books.find(contentId);
+  if (i != books.end() && i->state == State::Queued) {
+    queue.remove(i->priority);
+  }
+}
+
+bool SyncQueue::retry(QString contentId, CLI::FailureReason reason) {
+  const RetryPolicy *policy = getPolicy(reason);
+  Book &book = books[contentId];
+
+  book.reason = reason;
+  book.retryAt = 0;
+
+  if (book.attempts < policy->attempts) {
+    book.attempts++;
+    qint64 delay = backoff(policy, book.attempts);
+    book.retryAt = QDateTime::currentMSecsSinceEpoch() + delay;
+
+    nh_log("Retrying %s in %lld seconds (attempt %d of %d)", qPrintable(contentId), delay / 1000, book.attempts,
+           policy->attempts);
+  } else if (policy->onNetwork && Settings::getInstance()->isRetryOnNetwork()) {
+    nh_log("Retrying %s next time WiFi connects", qPrintable(contentId));
+  } else {
+    nh_log("Giving up on %s after %d retries", qPrintable(contentId), book.attempts);
+    return false;
+  }
+
+  // Retrying sends the latest progress anyway
+  book.state = State::RetryWait;
+  book.resend = false;
+  return true;
+}
+
+void SyncQueue::schedule() {
+  qint64 next = 0;
+
+  QHash<QString, Book>::const_iterator i = books.constBegin();
+  while (i != books.constEnd()) {
+    if (i->state == State::RetryWait && i->retryAt > 0 && (next == 0 || i->retryAt < next)) {
+      next = i->retryAt;
+    }
+    ++i;
+  }
+
+  if (next == scheduled)
+    return;
+
+  if (retryTimer != nullptr) {
+    retryTimer->deleteLater();
+    retryTimer = nullptr;
+  }
+
+  scheduled = next;
+  if (next == 0)
+    return;
+
+  // Retries that came due while the Kobo was off go out right away
+  QDateTime time = QDateTime::fromMSecsSinceEpoch(qMax(next, QDateTime::currentMSecsSinceEpoch() + 1000));
+  nh_log("Next retry at %s", qPrintable(time.toString()));
+
+  retryTimer = construct_PowerTimer("NickelHardcover-retry", this);
+  PowerTimer__fireAt(retryTimer, time);
+  QObject::connect(retryTimer, SIGNAL(timeout()), this, SLOT(retryDue()));
+}
+
+void SyncQueue::retryDue() {
+  // A timeout queued by a timer schedule() already replaced, the retries it was for are now on the new timer
+  if (sender() != retryTimer)
+    return;
+
+  // The retryTimer may fire a little early
+  qint64 now = QDateTime::currentMSecsSinceEpoch() + 1000;
+
+  QStringList due;
+  QHash<QString, Book>::const_iterator i = books.constBegin();
+  while (i != books.constEnd()) {
+    if (i->state == State::RetryWait && i->retryAt > 0 && i->retryAt <= now) {
+      due.append(i.key());
+    }
+    ++i;
+  }
+
+  // Sorted so the order books are queued in doesn't depend on hashing
+  due.sort();
+
+  foreach (const QString &contentId, due) {
+    enqueue(contentId);
+  }
+
+  scheduled = 0;
+  retryTimer->deleteLater();
+  retryTimer = nullptr;
+
+  schedule();
+  runBatch();
+}
+
 void SyncQueue::updateReadProgress(QString contentId) {
   MainWindowController *mwc = MainWindowController__sharedInstance();
   QWidget *cv = MainWindowController__currentView(mwc);
 
-  int newProgress = ReadingView__getCalculatedReadProgress(cv);
+  updateReadProgress(contentId, ReadingView__getCalculatedReadProgress(cv));
+}
+
+void SyncQueue::updateReadProgress(QString contentId, int newProgress) {
   if (newProgress == 99) {
     newProgress = 100;
   }
@@ -26,63 +291,211 @@ void SyncQueue::updateReadProgress(QString contentId) {
   }
 
   progress[contentId] = newProgress;
+  persist(contentId);
+
+  if (books.value(contentId).state == State::Queued) {
+    enqueue(contentId);
+  }
 
   nh_log("Update %s queued progress to %d%%", qPrintable(contentId), progress[contentId]);
 }
 
 int SyncQueue::getReadProgress(QString contentId) { return progress[contentId]; }
 
-void SyncQueue::clearReadProgress(QString contentId) { progress.remove(contentId); }
+void SyncQueue::clearReadProgress(QString contentId) {
+  progress.remove(contentId);
+  persist(contentId);
+}
 
 bool SyncQueue::checkThreshold(QString contentId, int threshold) {
   return threshold > 0 && progress[contentId] > 0 &&
          abs(Settings::getInstance()->getLastProgress(contentId) - progress[contentId]) >= threshold;
 }
 
+// Everything already queued goes out with the burst, retries waiting for the network only join it when asked to
 void SyncQueue::networkConnected() {
-  if (retryQueue.isEmpty() || !Settings::getInstance()->isRetryOnNetwork())
-    return;
+  QStringList retries;
+  if (Settings::getInstance()->isRetryOnNetwork()) {
+    QHash<QString, Book>::const_iterator i = books.constBegin();
+    while (i != books.constEnd()) {
+      if (i->state == State::RetryWait && getPolicy(i->reason)->onNetwork) {
+        retries.append(i.key());
+      }
+      ++i;
+    }
+  }
+
+  if (!retries.isEmpty()) {
+    nh_log("Retrying %d items", retries.size());
+
+    // Sorted so the order books are queued in doesn't depend on hashing
+    retries.sort();
 
-  nh_log("Retrying %d items", retryQueue.size());
+    foreach (const QString &contentId, retries) {
+      enqueue(contentId);
+    }
 
-  foreach (const QString &value, retryQueue) {
-    queue.insert(value);
+    schedule();
   }
 
-  retryQueue.clear();
-  prepareNext();
+  runBatch();
 }
 
 void SyncQueue::runAll() {
-  QHash<QString, int>::const_iterator i = progress.constBegin();
-  while (i != progress.constEnd()) {
-    queue.insert(i.key());
-    ++i;
+  QStringList contentIds = progress.keys();
+  contentIds.sort();
+
+  foreach (const QString &contentId, contentIds) {
+    enqueue(contentId);
   }
 
-  prepareNext();
+  runBatch();
+}
+
+void SyncQueue::runBatch() {
+  // Whatever is queued meanwhile goes out once a sync is done
+  if (syncs >= MAX_SYNCS || queue.isEmpty())
+    return;
+
+  sendBatch(queue.values(), false);
 }
 
-void SyncQueue::prepareNext() {
-  QObject::connect(this, &SyncQueue::finished, this, &SyncQueue::prepareNext, Qt::UniqueConnection);
+void SyncQueue::runBeforeSleep(QString contentId, int budget) {
+  if (!sleepSync.isNull())
+    return;
+
+  enqueue(contentId);
+
+  // Only the most urgent books, the rest stay queued with their retry state for the next alarm or connection
+  QStringList urgent = queue.values().mid(0, MAX_SLEEP_BOOKS);
+
+  sleepClock.start();
+  sleepBudget = budget;
+  sleepSync = sendBatch(urgent, true);
+
+  if (!sleepSync.isNull()) {
+    deadline->start(budget);
+  }
+}
+
+void SyncQueue::sleepDeadline() {
+  CLI *cli = sleepSync;
+  if (cli == nullptr)
+    return;
+
+  QStringList contentIds = sleepBooks;
+  nh_log("Pre-sleep sync ran out of time, leaving %d books pending", contentIds.size());
+
+  finishSleep();
+  syncs--;
 
-  if (queue.isEmpty()) {
+  // Cancels the request and drops its connections to us
+  cli->detach(this);
+
+  // Back in the queue without losing their attempts so far
+  foreach (const QString &contentId, contentIds) {
+    books[contentId].state = State::Idle;
+    enqueue(contentId);
+  }
+
+  DiskWriter::getInstance()->flush(true);
+}
+
+// Drop the progress and retries of books no longer on the device, a book being synced is left to finish
+int SyncQueue::collectGarbage(QStringList contentIds) {
+  QSet<QString> kept = QSet<QString>::fromList(contentIds);
+  QSet<QString> stored = QSet<QString>::fromList(progress.keys()) + QSet<QString>::fromList(books.keys());
+
+  int removed = 0;
+  foreach (const QString &contentId, stored - kept) {
+    if (books.value(contentId).state == State::InFlight)
+      continue;
+
+    dequeue(contentId);
+    books.remove(contentId);
+    progress.remove(contentId);
+    persist(contentId);
+    removed++;
+  }
+
+  nh_log("Removed %d queued books no longer on the device", removed);
+  return removed;
+}
+
+void SyncQueue::finishSleep() {
+  deadline->stop();
+  nh_log("Pre-sleep sync used %lld of %d ms", sleepClock.elapsed(), sleepBudget);
+
+  sleepSync = nullptr;
+  sleepBooks.clear();
+}
+
+CLI *SyncQueue::sendBatch(QStringList queued, bool beforeSleep) {
+  QJsonArray batch;
+  QStringList contentIds;
+  foreach (const QString &contentId, queued) {
+    dequeue(contentId);
+
+    int value = progress.value(contentId);
+    if (value == 0) {
+      books.remove(contentId);
+      persist(contentId);
+      continue;
+    }
+
+    nh_log("Sync %s at %d%%", qPrintable(contentId), value);
+
+    QJsonObject book;
+    book.insert("content_id", contentId);
+    book.insert("value", value);
+
+    QString linkedId = Settings::getInstance()->getLinkedId(contentId);
+    if (!linkedId.isEmpty()) {
+      book.insert("linked_id", linkedId.toLongLong());
+    }
+
+    batch.append(book);
+    contentIds.append(contentId);
+
+    Book &state = books[contentId];
+    state.state = State::InFlight;
+    state.syncing = value;
+  }
+
+  if (contentIds.isEmpty()) {
     nh_log("No more items in queue");
-    QObject::disconnect(this, &SyncQueue::finished, this, &SyncQueue::prepareNext);
-  } else {
-    QString contentId = *queue.begin();
-    queue.remove(contentId);
+    return nullptr;
+  }
 
-    nh_log("Syncing %s", qPrintable(contentId));
-    run(contentId);
+  nh_log("Syncing %d books", contentIds.size());
+
+  CLI::Options options;
+  options.silent = true;
+  options.icon = true;
+  options.priority = CLI::Priority::Background;
+
+  // Lets the deadline cancel the request
+  if (beforeSleep) {
+    options.owner = this;
+    sleepBooks = contentIds;
   }
+
+  syncs++;
+
+  CLI *cli = CLI::updateBatch(batch, options);
+  QObject::connect(cli, &CLI::response, this,
+                   [this, contentIds, beforeSleep](QJsonObject doc) { batchResponse(contentIds, doc, beforeSleep); });
+  QObject::connect(cli, &CLI::failure, this, [this, contentIds, beforeSleep](CLI::FailureReason reason) {
+    batchFailure(contentIds, reason, beforeSleep);
+  });
+
+  return cli;
 }
 
 void SyncQueue::run(QString contentId, bool manual) {
-  retryQueue.remove(contentId);
-  currentProgress = progress[contentId];
+  int value = progress.value(contentId);
 
-  if (currentProgress == 0) {
+  if (value == 0) {
     nh_log("Attempted to sync %s with no saved reading progress", qPrintable(contentId));
     ConfirmationDialogFactory__showErrorDialog("Hardcover.app",
                                                "Reading progress must be at least 2% to sync with Hardcover.app");
@@ -91,53 +504,179 @@ void SyncQueue::run(QString contentId, bool manual) {
   }
 
   failed = false;
-  this->currentContentId = contentId;
 
   if (manual) {
+    closeDialog();
+    dialogContentId = contentId;
     dialog = ConfirmationDialogFactory__getConfirmationDialog(nullptr);
     ConfirmationDialog__showCloseButton(dialog, false);
     ConfirmationDialog__setText(dialog, "Syncing with Hardcover.app...");
     dialog->open();
   }
 
+  State state = books.value(contentId).state;
+
+  // Coalesce into the sync already in flight instead of racing it
+  if (state == State::InFlight) {
+    enqueue(contentId);
+    return;
+  }
+
+  // Automatic syncs wait for a free slot, the reader is waiting on a manual one
+  if (!manual && syncs >= MAX_SYNCS) {
+    enqueue(contentId);
+    return;
+  }
+
+  start(contentId, manual);
+}
+
+void SyncQueue::start(QString contentId, bool manual) {
+  dequeue(contentId);
+
+  Book &book = books[contentId];
+  book.state = State::InFlight;
+  book.syncing = progress.value(contentId);
+  persist(contentId);
+
   CLI::Options options;
   options.silent = !manual;
   options.icon = true;
+  options.priority = manual ? CLI::Priority::Interactive : CLI::Priority::Background;
   options.contentId = contentId;
 
-  CLI *cli = CLI::update(currentProgress, options);
-  QObject::connect(cli, &CLI::success, this, &SyncQueue::success);
-  QObject::connect(cli, &CLI::failure, this, &SyncQueue::failure);
+  syncs++;
+
+  CLI *cli = CLI::update(book.syncing, options);
+  QObject::connect(cli, &CLI::success, this, [this, contentId] {
+    syncs--;
+    complete(contentId, true);
+    schedule();
+    runBatch();
+  });
+  QObject::connect(cli, &CLI::failure, this, [this, contentId](CLI::FailureReason reason) {
+    syncs--;
+    complete(contentId, false, reason);
+    schedule();
+    runBatch();
+  });
 }
 
-void SyncQueue::success() {
-  if (currentProgress == 100) {
-    Settings::getInstance()->setEnabled(currentContentId, false);
+void SyncQueue::complete(QString contentId, bool synced, CLI::FailureReason reason) {
+  Book &book = books[contentId];
+  int value = book.syncing;
+  bool resend = book.resend;
+
+  if (synced) {
+    if (value == 100) {
+      Settings::getInstance()->setEnabled(contentId, false);
+    }
+
+    Settings::getInstance()->setLastProgress(contentId, value);
+  } else {
+    failed = true;
   }
 
-  Settings::getInstance()->setLastProgress(currentContentId, currentProgress);
-  progress.remove(currentContentId);
+  if (synced || !retry(contentId, reason)) {
+    // Keep progress made while the sync was running, and all of it for a book that has to be linked first
+    if (progress.value(contentId) == value && (synced || reason != CLI::FailureReason::BookNotFound)) {
+      progress.remove(contentId);
+    }
+
+    books.remove(contentId);
 
+    if (resend && progress.value(contentId) > 0) {
+      enqueue(contentId);
+      return;
+    }
+  }
+
+  persist(contentId);
   finished();
 
-  if (dialog == nullptr)
+  if (dialog == nullptr || contentId != dialogContentId)
     return;
 
-  ConfirmationDialog__setText(dialog, "Success!");
-  QTimer::singleShot(800, this, &SyncQueue::closeDialog);
+  if (synced) {
+    ConfirmationDialog__setText(dialog, "Success!");
+    QTimer::singleShot(800, this, &SyncQueue::closeDialog);
+  } else {
+    closeDialog();
+  }
 }
 
-void SyncQueue::failure(CLI::FailureReason reason) {
-  failed = true;
+void SyncQueue::batchResponse(QStringList contentIds, QJsonObject doc, bool beforeSleep) {
+  syncs--;
+
+  if (beforeSleep) {
+    finishSleep();
+  }
+
+  bool prompted = false;
+
+  foreach (const QJsonValue &value, doc.value("results").toArray()) {
+    QJsonObject result = value.toObject();
+    QString contentId = result.value("content_id").toString();
+    QString status = result.value("status").toString();
+
+    if (!contentIds.removeOne(contentId))
+      continue;
+
+    if (status != "ok") {
+      nh_log("Failed to sync %s (%s): %s", qPrintable(contentId), qPrintable(status),
+             qPrintable(result.value("message").toString()));
+    }
+
+    if (status == "ok") {
+      complete(contentId, true);
+    } else if (status == "book_not_found") {
+      complete(contentId, false, CLI::FailureReason::BookNotFound);
+
+      // Asked about the open book only, the others keep their progress and are asked about once opened and synced
+      // again. Nobody is there to answer before sleeping.
+      if (!prompted && !beforeSleep && contentId == SyncController::getInstance()->contentId) {
+        prompted = true;
+        CLI::promptLink(contentId, CLI::Options().getQuery(), result.value("message").toString());
+      }
+    } else {
+      complete(contentId, false, CLI::FailureReason::Error);
+    }
+  }
+
+  // Books missing from the results weren't synced
+  foreach (const QString &contentId, contentIds) {
+    complete(contentId, false, CLI::FailureReason::Error);
+  }
+
+  schedule();
 
-  if (reason == CLI::FailureReason::Network && Settings::getInstance()->isRetryOnNetwork()) {
-    retryQueue.insert(currentContentId);
+  // Nothing else goes out once the Kobo is about to sleep, what this sync changed is written before it does
+  if (beforeSleep) {
+    DiskWriter::getInstance()->flush(true);
   } else {
-    progress.remove(currentContentId);
+    runBatch();
   }
+}
 
-  closeDialog();
-  finished();
+void SyncQueue::batchFailure(QStringList contentIds, CLI::FailureReason reason, bool beforeSleep) {
+  syncs--;
+
+  if (beforeSleep) {
+    finishSleep();
+  }
+
+  foreach (const QString &contentId, contentIds) {
+    complete(contentId, false, reason);
+  }
+
+  schedule();
+
+  // Nothing else goes out once the Kobo is about to sleep, what this sync changed is written before it does
+  if (beforeSleep) {
+    DiskWriter::getInstance()->flush(true);
+  } else {
+    runBatch();
+  }
 }
 
 void SyncQueue::closeDialog() {
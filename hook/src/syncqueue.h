@@ -1,10 +1,17 @@
+#pragma once
+
+#include <QElapsedTimer>
 #include <QLabel>
+#include <QMap>
 #include <QNetworkAccessManager>
 #include <QObject>
+#include <QPointer>
 #include <QSettings>
+#include <QTimer>
 
 #include "cli.h"
 #include "nickelhardcover.h"
+#include "recordlog.h"
 
 class SyncQueue : public QObject {
   Q_OBJECT
@@ -13,32 +20,93 @@ public:
   SyncQueue(QObject *parent = nullptr);
 
   void updateReadProgress(QString contentId);
+  void updateReadProgress(QString contentId, int newProgress);
   int getReadProgress(QString contentId);
   void clearReadProgress(QString contentId);
   bool checkThreshold(QString contentId, int threshold);
 
   void runAll();
   void run(QString contentId, bool manual = false);
+  void runBeforeSleep(QString contentId, int budget);
+  int collectGarbage(QStringList contentIds);
 
   bool failed = false;
 
 public Q_SLOTS:
   void networkConnected();
-  void prepareNext();
-  void success();
-  void failure(CLI::FailureReason reason);
+  void retryDue();
+  void sleepDeadline();
   void closeDialog();
 
 Q_SIGNALS:
   void finished();
 
 private:
-  ConfirmationDialog *dialog = nullptr;
+  enum class State { Idle, Queued, InFlight, RetryWait };
+
+  // Position in the queue, entries that compare less are synced first
+  struct Priority {
+    bool complete;
+    bool open;
+    int delta;
+    // Milliseconds since epoch the book was last read, from the reading sessions
+    qint64 read;
+    quint64 sequence;
 
-  QString currentContentId;
-  int currentProgress = 0;
+    bool operator<(const Priority &other) const;
+  };
+
+  // Books that aren't idle, idle books have no entry
+  struct Book {
+    State state = State::Idle;
+    Priority priority = {false, false, 0, 0, 0};
+    // Progress sent by the sync in flight
+    int syncing = 0;
+    // Sync again with the latest progress once the sync in flight is done
+    bool resend = false;
+    // Retries scheduled since the last successful sync
+    int attempts = 0;
+    CLI::FailureReason reason = CLI::FailureReason::Network;
+    // Milliseconds since epoch, 0 when only retried once WiFi connects
+    qint64 retryAt = 0;
+  };
+
+  ConfirmationDialog *dialog = nullptr;
+  QString dialogContentId;
 
   QHash<QString, int> progress;
-  QSet<QString> queue;
-  QSet<QString> retryQueue;
+  QHash<QString, Book> books;
+  QMap<Priority, QString> queue;
+  quint64 sequence = 0;
+
+  // Syncs in flight, each a single book or a batch
+  int syncs = 0;
+
+  // Wakes the Kobo for the earliest scheduled retry
+  PowerTimer *retryTimer = nullptr;
+  qint64 scheduled = 0;
+
+  // Sync started as the Kobo goes to sleep, cancelled once it runs out of time
+  QPointer<CLI> sleepSync;
+  QStringList sleepBooks;
+  QTimer *deadline = new QTimer(this);
+  QElapsedTimer sleepClock;
+  int sleepBudget = 0;
+
+  // Unsynced progress and retries survive a restart
+  RecordLog store;
+
+  void enqueue(QString contentId);
+  void dequeue(QString contentId);
+  void start(QString contentId, bool manual);
+  void runBatch();
+  void complete(QString contentId, bool synced, CLI::FailureReason reason = CLI::FailureReason::Error);
+  bool retry(QString contentId, CLI::FailureReason reason);
+  void schedule();
+  CLI *sendBatch(QStringList queued, bool beforeSleep);
+  void finishSleep();
+  void batchResponse(QStringList contentIds, QJsonObject doc, bool beforeSleep);
+  void batchFailure(QStringList contentIds, CLI::FailureReason reason, bool beforeSleep);
+  void load();
+  void persist(QString contentId);
 };
@@ -0,0 +1,71 @@
+#include <NickelHook.h>
+
+#include "settings.h"
+#include "wifisession.h"
+
+WifiSession *WifiSession::instance = nullptr;
+
+WifiSession *WifiSession::getInstance() {
+  if (instance == nullptr) {
+    instance = new WifiSession();
+  };
+
+  return instance;
+};
+
+WifiSession::WifiSession(QObject *parent) : QObject(parent) {
+  linger = new QTimer(this);
+  linger->setSingleShot(true);
+  connect(linger, &QTimer::timeout, this, &WifiSession::end);
+};
+
+void WifiSession::begin() {
+  nh_log("WifiSession::begin()");
+
+  start();
+
+  // Linger even if nothing is waiting, any request sent from here on holds the session open
+  idle();
+
+  // Everything that was waiting for the network goes out in the same burst
+  flush();
+}
+
+void WifiSession::busy() {
+  linger->stop();
+  start();
+}
+
+void WifiSession::start() {
+  if (active)
+    return;
+
+  active = true;
+  clock.start();
+  requests = 0;
+  bytes = 0;
+}
+
+void WifiSession::idle() {
+  if (!active)
+    return;
+
+  linger->start(qMax(Settings::getInstance()->getWifiLinger(), 0) * 1000);
+}
+
+void WifiSession::record(int requests, qint64 bytes) {
+  this->requests += requests;
+  this->bytes += bytes;
+}
+
+void WifiSession::end() {
+  if (!active)
+    return;
+
+  nh_log("Wi-Fi session: %lld seconds online, %d requests sent, %lld bytes moved", clock.elapsed() / 1000, requests,
+         bytes);
+
+  // The connection itself is left to the Kobo's own idle timeout. Airplane mode is never used as the user would see it
+  // and it would cut off anything else still online.
+  active = false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+class WifiSession : public QObject {
+  Q_OBJECT
+
+public:
+  static WifiSession *getInstance();
+
+  void begin();
+  void busy();
+  void idle();
+  void record(int requests, qint64 bytes);
+
+public Q_SLOTS:
+  void end();
+
+Q_SIGNALS:
+  void flush();
+
+private:
+  WifiSession(QObject *parent = nullptr);
+
+  static WifiSession *instance;
+
+  void start();
+
+  QTimer *linger = nullptr;
+  QElapsedTimer clock;
+  bool active = false;
+
+  int requests = 0;
+  qint64 bytes = 0;
+};